@@ -0,0 +1,84 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+/// \brief Runs fixed workloads through every engine for a fixed number of generations and reports
+/// the speed, memory use and a checksum of the final cells of each run. The synthetic workloads
+/// come from a fixed seed, so the checksums only change when the simulation does.
+class Benchmark
+{
+    public:
+        explicit Benchmark(int generations);
+
+        /// \brief Add the circuit in filename (as is, tiled 3x3 and tiled 8x1 for a wide board) and
+        /// the synthetic workloads. The file based ones are skipped if it can't be loaded.
+        void addStandardWorkloads(const std::string& filename);
+
+        /// \brief Run every workload through every engine, printing a line per run to log
+        void run(std::ostream& log);
+
+        void writeJson(std::ostream& out) const;
+
+        /// \brief Run the blocked engine on the file in filename tiled 4x4 with 1, 2, 4... threads up
+        /// to maxThreads, printing the speed-up over one thread. Each run with more than one thread
+        /// is done twice, with the cells of each band first touched by its thread and with all of
+        /// them touched by one thread, to show what placing them on the right NUMA node is worth.
+        /// \return false if the file can't be loaded
+        bool runScaling(const std::string& filename, int maxThreads, std::ostream& log);
+
+    private:
+        struct Workload
+        {
+            std::string name;
+            int width;
+            int height;
+            std::vector<CellState> cells; // Row-major
+        };
+
+        struct Result
+        {
+            std::string workload;
+            std::string engine;
+            int width;
+            int height;
+            std::size_t conductors;
+            double setupSeconds; // Loading the cells, plus extraction for the logic engine
+            double seconds; // Stepping only
+            std::size_t peakRss; // Of the process which did the run alone, in bytes, or 0 if not measured
+            unsigned long long checksum;
+            bool failed; // The process doing the run died, so there are no timings or checksum
+        };
+
+        void addFile(const std::string& name, const std::string& filename, int columns, int rows);
+        void addMesh(const std::string& name, int size, int spacing);
+        void addRandomLoops(const std::string& name, int size, int loops);
+
+        Result runWorkload(const Workload& workload, const std::string& engine, int threads = 1,
+                           bool firstTouch = true) const;
+
+        /// \brief runWorkload() in a child process of its own, so the peak resident set is that of the
+        /// run alone, plus what the benchmark held when it started the child. A child which dies
+        /// gives a failed result. Without fork() the run is in this process, and its peak resident
+        /// set isn't measured.
+        Result runIsolated(const Workload& workload, const std::string& engine) const;
+
+        /// \brief Step every engine which runs on Grid from cells still pending at the first update(),
+        /// as the window does after loading, with another cell set between a flip() and an update()
+        /// later on, and compare the results with the reference engine
+        /// \return false with a line in log for each engine which differs
+        bool checkEdits(const Workload& workload, std::ostream& log) const;
+
+        /// \brief FNV-1a hash of row-major cell states
+        static unsigned long long checksum(const std::vector<CellState>& cells);
+
+        int mGenerations;
+        std::vector<Workload> mWorkloads;
+        std::vector<Result> mResults;
+};
+
+#endif // BENCHMARK_HPP
@@ -0,0 +1,305 @@
+#ifndef CONTROLSERVER_HPP
+#define CONTROLSERVER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <SFML/Network.hpp>
+
+#include "Grid.hpp"
+#include "Probes.hpp"
+#include "Trace.hpp"
+
+class InfiniteGrid;
+
+/// \brief Lets scripts drive the simulator over TCP from the same machine. A thread accepts
+/// connections and receives requests, and the thread which owns the board runs them from poll()
+/// or wait(), so the board is never touched by two threads.
+///
+/// Each request is one sf::Packet (a 32-bit big-endian byte count followed by the data) holding a
+/// batch of commands, and is answered by one packet holding a reply per command, so a script can
+/// send many edits and reads in a single round trip. Every command starts with its Command byte,
+/// and every reply starts with a Status byte, followed by a message string if it failed or by the
+/// command's results. Strings are a 32-bit length and the bytes, and all integers are big-endian.
+/// A batch stops at the first command which can't be decoded.
+class ControlServer
+{
+    public:
+        enum Command
+        {
+            LOAD = 1, // string path
+            SET, // int32 x, int32 y, uint8 state
+            STEP, // uint32 generations
+            READ, // int32 x, int32 y, uint32 width, uint32 height -> width*height state bytes, row-major
+            ADD_PROBE, // string name, int32 x, int32 y
+            READ_PROBES, // -> uint32 count, then uint32 generation and string name per head since the last read
+            SAVE, // string path
+            INFO, // -> uint32 generation, int32 width, int32 height (both 0 for an unbounded grid)
+            SHUTDOWN
+        };
+
+        enum Status
+        {
+            OK,
+            FAILED // Followed by a message
+        };
+
+        ControlServer();
+
+        ~ControlServer();
+
+        /// \brief Listen for connections on a port. Connections from other machines are refused.
+        bool start(unsigned short port);
+
+        /// \brief Close every connection and stop the network thread
+        void stop();
+
+        /// \brief Run the waiting request, if there is one, on a board. Edits are committed with
+        /// flip() before anything reads or steps the board, and at the end of the batch.
+        /// \return false once a client has asked for SHUTDOWN
+        template <typename Board>
+        bool poll(Board& board, Probes& probes);
+
+        /// \brief Wait for a request and run it on a board
+        /// \return false once a client has asked for SHUTDOWN, or the server has stopped
+        template <typename Board>
+        bool wait(Board& board, Probes& probes);
+
+    private:
+        /// \brief Network thread: accepts clients and hands their requests over to poll(). Client
+        /// sockets don't block, so a slow client doesn't hold up the others or the board.
+        void serve();
+
+        /// \brief Queue a request and block until poll() has answered it
+        /// \return false if the server stopped first
+        bool submit(sf::Packet& request, sf::Packet& reply);
+
+        template <typename Board>
+        void execute(sf::Packet& request, sf::Packet& reply, Board& board, Probes& probes);
+
+        static void fail(sf::Packet& reply, const std::string& message);
+
+        // Board specific parts of execute()
+        static bool isInside(const Grid& board, int x, int y);
+        static bool isInside(const InfiniteGrid& board, int x, int y);
+        static int getWidth(const Grid& board) {return board.getWidth();}
+        static int getWidth(const InfiniteGrid&) {return 0;}
+        static int getHeight(const Grid& board) {return board.getHeight();}
+        static int getHeight(const InfiniteGrid&) {return 0;}
+
+        sf::TcpListener mListener;
+        std::thread mThread;
+
+        // Hand-over between the network thread and poll(), guarded by mMutex
+        std::mutex mMutex;
+        std::condition_variable mChanged;
+        sf::Packet mRequest;
+        sf::Packet mReply;
+        bool mHasRequest;
+        bool mHasReply;
+        bool mRunning;
+        bool mShutdown;
+
+        unsigned int mGeneration; // Generations stepped by STEP since the last LOAD
+};
+
+template <typename Board>
+bool ControlServer::poll(Board& board, Probes& probes)
+{
+    sf::Packet request;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mHasRequest)
+            return !mShutdown;
+        request = mRequest;
+    }
+
+    sf::Packet reply;
+    execute(request, reply, board, probes);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mReply = reply;
+    mHasRequest = false;
+    mHasReply = true;
+    mChanged.notify_all();
+    return !mShutdown;
+}
+
+template <typename Board>
+bool ControlServer::wait(Board& board, Probes& probes)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (mRunning && !mHasRequest && !mShutdown)
+            mChanged.wait(lock);
+        if (!mRunning)
+            return false;
+    }
+    return poll(board, probes);
+}
+
+template <typename Board>
+void ControlServer::execute(sf::Packet& request, sf::Packet& reply, Board& board, Probes& probes)
+{
+    TraceScope trace("control batch", "io");
+
+    // SET only writes the next state, so commit edits before anything looks at the board
+    bool edited = false;
+    auto commit = [&]()
+    {
+        if (edited)
+            board.flip();
+        edited = false;
+    };
+
+    while (!request.endOfPacket())
+    {
+        sf::Uint8 command = 0;
+        request >> command;
+
+        switch (command)
+        {
+            case LOAD:
+            {
+                std::string path;
+                if (!(request >> path))
+                    break;
+                edited = false;
+                if (!board.loadFromFile(path))
+                {
+                    fail(reply, "Failed to load " + path);
+                    continue;
+                }
+                board.flip();
+                probes.clearEvents();
+                mGeneration = 0;
+                reply << sf::Uint8(OK);
+                continue;
+            }
+
+            case SET:
+            {
+                sf::Int32 x = 0;
+                sf::Int32 y = 0;
+                sf::Uint8 state = 0;
+                if (!(request >> x >> y >> state))
+                    break;
+                if (state > TAIL || !isInside(board, x, y))
+                {
+                    fail(reply, "Bad cell or state");
+                    continue;
+                }
+                board.setCell(x, y, static_cast<CellState>(state));
+                edited = true;
+                reply << sf::Uint8(OK);
+                continue;
+            }
+
+            case STEP:
+            {
+                sf::Uint32 generations = 0;
+                if (!(request >> generations))
+                    break;
+                commit();
+                for (sf::Uint32 generation = 0; generation < generations; generation++)
+                {
+                    board.update();
+                    board.flip();
+                    probes.sample(board, ++mGeneration);
+                }
+                reply << sf::Uint8(OK);
+                continue;
+            }
+
+            case READ:
+            {
+                sf::Int32 x = 0;
+                sf::Int32 y = 0;
+                sf::Uint32 width = 0;
+                sf::Uint32 height = 0;
+                if (!(request >> x >> y >> width >> height))
+                    break;
+                if (static_cast<unsigned long long>(width)*height > (1u << 24))
+                {
+                    fail(reply, "Region too large");
+                    continue;
+                }
+                commit();
+                reply << sf::Uint8(OK);
+                std::string row(width, NONE);
+                for (sf::Uint32 dy = 0; dy < height; dy++)
+                {
+                    for (sf::Uint32 dx = 0; dx < width; dx++)
+                        row[dx] = isInside(board, x + dx, y + dy) ? board.getCell(x + dx, y + dy) : NONE;
+                    reply.append(row.data(), row.size());
+                }
+                continue;
+            }
+
+            case ADD_PROBE:
+            {
+                std::string name;
+                sf::Int32 x = 0;
+                sf::Int32 y = 0;
+                if (!(request >> name >> x >> y))
+                    break;
+                commit();
+                if (!isInside(board, x, y) || board.getCell(x, y) == NONE)
+                {
+                    fail(reply, "Probe " + name + " is not on a wire");
+                    continue;
+                }
+                probes.add(name, x, y);
+                reply << sf::Uint8(OK);
+                continue;
+            }
+
+            case READ_PROBES:
+            {
+                const std::vector<Probes::Event>& events = probes.getEvents();
+                reply << sf::Uint8(OK) << sf::Uint32(events.size());
+                for (const Probes::Event& event : events)
+                    reply << sf::Uint32(event.generation) << probes.getName(event.probe);
+                probes.clearEvents();
+                continue;
+            }
+
+            case SAVE:
+            {
+                std::string path;
+                if (!(request >> path))
+                    break;
+                commit();
+                if (!board.saveToFile(path))
+                    fail(reply, "Failed to write " + path);
+                else
+                    reply << sf::Uint8(OK);
+                continue;
+            }
+
+            case INFO:
+                commit();
+                reply << sf::Uint8(OK) << sf::Uint32(mGeneration) << sf::Int32(getWidth(board))
+                      << sf::Int32(getHeight(board));
+                continue;
+
+            case SHUTDOWN:
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mShutdown = true;
+                reply << sf::Uint8(OK);
+                continue;
+            }
+        }
+
+        // Only reached when a command couldn't be decoded
+        fail(reply, "Malformed command");
+        break;
+    }
+
+    commit();
+}
+
+#endif // CONTROLSERVER_HPP
@@ -0,0 +1,55 @@
+#ifndef FRAMEPROFILER_HPP
+#define FRAMEPROFILER_HPP
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+/// \brief Times the phases of each frame of the main loop and keeps the most recent samples of
+/// each, so slow frames can be put down to the simulation or to rendering. Reports the 50th, 95th
+/// and 99th percentiles as a log line or as an overlay of bars.
+class FrameProfiler
+{
+    public:
+        enum Phase
+        {
+            EVENTS, // Polling window events
+            UPDATE, // Grid::update()
+            EDIT, // Mouse editing and camera movement
+            FLIP, // Grid::flip()
+            IO, // Control server requests and publishing the frame
+            DRAW, // Clearing and drawing the grid
+            DISPLAY, // Presenting the frame, including any wait for vertical sync
+            PHASE_COUNT
+        };
+
+        /// \param samples Number of recent frames the percentiles are taken over
+        explicit FrameProfiler(std::size_t samples = 240);
+
+        /// \brief Charge the time since the previous lap to a phase
+        void lap(Phase phase);
+
+        /// \brief Time under which the given percentage of recent samples of a phase fall
+        double getPercentile(Phase phase, double percent) const;
+
+        /// \brief Print the percentiles of every phase on one line, in milliseconds
+        void printSummary(std::ostream& out) const;
+
+        /// \brief Draw a bar per phase in the top left of the target, in its default view. Labels
+        /// are only drawn when a font is given.
+        void draw(sf::RenderTarget& target, const sf::Font* font = 0) const;
+
+        static const char* getPhaseName(Phase phase);
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        Clock::time_point mLast;
+        std::vector<double> mSamples[PHASE_COUNT]; // Milliseconds, used as a ring buffer
+        std::size_t mNext[PHASE_COUNT];
+        std::size_t mCapacity;
+};
+
+#endif // FRAMEPROFILER_HPP
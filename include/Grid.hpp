@@ -0,0 +1,373 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include <memory>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define TILE_SIZE 16
+
+class MemoryReport;
+
+namespace sf
+{
+    class RenderTarget;
+    class RenderStates;
+}
+
+enum CellState
+{
+    NONE,
+    WIRE,
+    HEAD,
+    TAIL
+};
+
+/// \brief Represents a wireworld grid. Responsible for maintaining, updating, and rendering the
+/// current state. Also, this representation of wireworld wraps both vertically and horizontally.
+/// Rendering lives in Render.cpp, the only part which needs SFML, so the grid can be built into the
+/// headless library without it.
+class Grid
+{
+    public:
+        /// \brief Kernels update() can use. They all give the same result.
+        enum Engine
+        {
+            REFERENCE, // Counts the eight neighbours of each interesting cell
+            LOOKUP, // Looks up the next state of four cells at a time from their packed head bits
+            MASKED, // Like REFERENCE, but only reads the neighbours which are wires, from a mask per cell
+            INCREMENTAL // Keeps a count of head neighbours per cell, changed only as heads come and go
+        };
+
+        /// \brief How the cells are arranged in memory. They all give the same result.
+        enum Layout
+        {
+            ROWS, // Row-major
+            TILES // 8x8 tiles stored row by row, each tile row-major, so a cell's neighbours are
+                  // usually in the same 128 bytes however wide the grid is
+        };
+
+        Grid(int width = 0, int height = 0);
+
+        ~Grid();
+
+        /// \brief Load a grid from a .wi file. The first line holds the dimensions, followed by one
+        /// line of cells per row (' ' none, '#' wire, '@' electron head, '~' electron tail). The
+        /// loaded cells are pending until the next flip().
+        bool loadFromFile(const std::string& filename);
+
+        /// \brief Load only a rectangle of a .wi file, `columns` by `rows` cells with its top left
+        /// corner at (left, top), wrapping around the edges of the file as the grid does, into a
+        /// grid of that size. Zero columns or rows takes the file's. The rest of the file is read
+        /// past without being kept.
+        bool loadFromFile(const std::string& filename, int left, int top, int columns, int rows);
+
+        /// \brief Read only the dimensions from the first line of a .wi file
+        static bool readSize(const std::string& filename, int& width, int& height);
+
+        /// \brief Write the current cells to a .wi file which loadFromFile() reads back unchanged
+        bool saveToFile(const std::string& filename) const;
+
+        /// \brief Update the grid
+        void update();
+
+        /// \brief Choose the kernel used by update()
+        void setEngine(Engine engine);
+        Engine getEngine() const {return mEngine;}
+
+        /// \brief Rearrange the cells in memory
+        void setLayout(Layout layout);
+        Layout getLayout() const {return mLayout;}
+
+        /// \brief Draw the grid
+        void draw(sf::RenderTarget& target) const;
+        void draw(sf::RenderTarget& target, const sf::RenderStates& states) const;
+
+        /// \brief Set the next state to the current state
+        void flip();
+
+        /// \brief Advance the grid by several generations, with the same result as calling update()
+        /// and flip() that many times. The grid is processed in tiles which are copied into a small
+        /// scratch buffer with a halo of `depth` cells and advanced `depth` generations before being
+        /// written back, so each pass over memory does `depth` generations of work. The depth is
+        /// kept between 1 and the tile size. Cells set since the last flip() are committed first, as
+        /// by flip(). With more than one thread, each advances the tiles of its own band of rows and
+        /// flips the cells of it.
+        void advance(long long generations, int depth = 4);
+
+        /// \brief Run advance() on a number of threads, each owning a band of whole rows of its
+        /// tiles. Each thread is pinned to a CPU, the bands spread over the NUMA nodes in order, and
+        /// the cells of each band are first touched by its thread, which places them in the memory
+        /// of its node. With firstTouch false the calling thread touches every cell, as with one
+        /// thread. The cells are moved over straight away.
+        void setThreads(int threads, bool firstTouch = true);
+        int getThreads() const {return mThreads;}
+
+        /// \brief Print the CPU and node of each band's thread and the nodes holding its cells
+        void printNumaReport(std::ostream& out) const;
+
+        /// \brief Get the contents of a cell
+        CellState getCell(int x, int y) const
+        {
+            return static_cast<CellState>(mCells[getIndex(x, y)].current);
+        }
+
+        /// \brief Get the state a cell will have after the next flip()
+        CellState getNextCell(int x, int y) const
+        {
+            return static_cast<CellState>(mCells[getIndex(x, y)].next);
+        }
+
+        /// \brief The cells in memory, each holding its current state in its first byte and its
+        /// next state in the second. Row-major in the ROWS layout. Valid until the grid is loaded,
+        /// resized or rearranged.
+        const unsigned char* getCellData() const {return &mCells[0].current;}
+        static std::size_t getCellStride() {return sizeof(Cell);}
+
+        /// \brief Set the contents of a cell.
+        void setCell(int x, int y, CellState cell);
+
+        /// \brief Compute the wrapped x coordinate
+        int wrapX(int x) const;
+
+        /// \brief Compute the wrapped y coordinate.
+        int wrapY(int y) const;
+
+        int getWidth() const {return mWidth;}
+        int getHeight() const {return mHeight;}
+
+        /// \brief Whether any current cell is an electron head
+        bool hasHeads() const;
+
+        /// \brief Hash of where the electrons are. Two states of the same grid with the same hash
+        /// are equal, barring a collision.
+        unsigned long long getStateHash() const;
+
+        /// \brief Add the memory held by the cells, the interesting list and the engine caches
+        void reportMemory(MemoryReport& report) const;
+
+    private:
+        /// \brief A CellState each, in a byte to keep the grid small
+        struct Cell
+        {
+            unsigned char current;
+            unsigned char next;
+        };
+
+        /// \brief Bits of the MASKED engine's wire masks, in reading order. The neighbour in direction k sees this
+        /// cell in direction 7-k.
+        enum Neighbours
+        {
+            TOP_LEFT = 1 << 0,
+            TOP = 1 << 1,
+            TOP_RIGHT = 1 << 2,
+            LEFT = 1 << 3,
+            RIGHT = 1 << 4,
+            BOTTOM_LEFT = 1 << 5,
+            BOTTOM = 1 << 6,
+            BOTTOM_RIGHT = 1 << 7
+        };
+
+        /// \brief Allocator which leaves new cells untouched, so no page of them is placed on a
+        /// NUMA node until the thread meant to work on it writes to it
+        template <typename T>
+        struct UntouchedAllocator : std::allocator<T>
+        {
+            template <typename U>
+            struct rebind
+            {
+                typedef UntouchedAllocator<U> other;
+            };
+
+            UntouchedAllocator() {}
+
+            template <typename U>
+            UntouchedAllocator(const UntouchedAllocator<U>&) {}
+
+            template <typename U>
+            void construct(U* p)
+            {
+                ::new (static_cast<void*>(p)) U;
+            }
+
+            template <typename U, typename... Args>
+            void construct(U* p, Args&&... args)
+            {
+                ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+            }
+        };
+
+        typedef std::vector<Cell, UntouchedAllocator<Cell>> Cells;
+
+        struct Position
+        {
+            int x;
+            int y;
+        };
+
+        /// \brief The conductors in each of advance()'s tiles and its halo, listed tile by tile.
+        /// Tiles without conductors are left out.
+        struct Blocks
+        {
+            std::vector<int> start; // Of each tile's conductors, then the end of the last
+            std::vector<int> origin; // x and y of each tile's top left cell
+            std::vector<int> source; // Index into mCells of each conductor
+            std::vector<unsigned short> localX; // Where each conductor is in the scratch buffer
+            std::vector<unsigned short> localY;
+        };
+
+        /// \brief Where a cell is in mCells. TILES puts four cells aligned to a multiple of four in
+        /// a row next to each other, like ROWS, which the LOOKUP engine relies on.
+        int getIndex(int x, int y) const
+        {
+            return mLayout == ROWS ? getIndex<ROWS>(x, y) : getIndex<TILES>(x, y);
+        }
+
+        /// \brief getIndex() for a layout known at compile time, for the kernels
+        template <Layout L>
+        int getIndex(int x, int y) const
+        {
+            if (L == ROWS)
+                return y*mWidth + x;
+            return (((y >> 3)*mTileColumns + (x >> 3)) << 6) | ((y & 7) << 3) | (x & 7);
+        }
+
+        /// \brief Coordinates of the cell at an index into mCells. Divides, so the kernels walk the
+        /// sorted interesting list with a Cursor instead.
+        Position getPosition(unsigned index) const;
+
+        /// \brief Finds the coordinates of increasing indices into mCells without dividing, by
+        /// moving down the rows (or rows of tiles) as the indices pass their ends
+        template <Layout L>
+        class Cursor
+        {
+            public:
+                explicit Cursor(const Grid& grid) : mBand(0), mBandStart(0),
+                    mBandSize(L == ROWS ? grid.mWidth : grid.mTileColumns*64) {}
+
+                Position operator()(unsigned index)
+                {
+                    while (index - mBandStart >= mBandSize)
+                    {
+                        mBand++;
+                        mBandStart += mBandSize;
+                    }
+                    unsigned offset = index - mBandStart;
+                    if (L == ROWS)
+                        return Position{static_cast<int>(offset), mBand};
+                    return Position{static_cast<int>((offset >> 6 << 3) | (offset & 7)),
+                                    (mBand << 3) | static_cast<int>((offset >> 3) & 7)};
+                }
+
+            private:
+                int mBand;
+                unsigned mBandStart;
+                unsigned mBandSize;
+        };
+
+        /// \brief Sort the cells added to the interesting list since the last call into it, and drop
+        /// duplicates and cells which have emptied. A few edits are merged in; after many (such as
+        /// loading) the whole list is radix sorted.
+        void sortInteresting();
+
+        /// \brief Set or clear a cell's bit in the wire masks of its neighbours, if there are masks.
+        /// Bits are set as soon as setCell() makes a cell a conductor, and only cleared once the cell
+        /// has emptied and left the interesting list, so a mask never misses a conductor.
+        void markWire(int x, int y, bool wire);
+
+        /// \brief Build the wire masks from the interesting list
+        void buildWires();
+
+        /// \brief Indices of the eight neighbours of a cell, wrapping around the edges
+        void getNeighbours(unsigned index, unsigned neighbours[8]) const;
+
+        /// \brief Find the heads and tails and count the heads around every cell, for INCREMENTAL
+        void buildHeadCounts();
+
+        /// \brief update() for the INCREMENTAL engine
+        void updateIncremental();
+
+        /// \brief flip() after updateIncremental(): moves the electrons and adjusts the counts
+        /// around the cells which became or stopped being heads
+        void flipIncremental();
+
+        /// \brief Size mCells for the grid and layout, emptying every cell
+        void allocate();
+
+        /// \brief Bands of rows the threads work on: one per thread, up to one per row of tiles
+        int getBandCount() const;
+
+        /// \brief First row of a band. The band after the last starts at the height.
+        int getBandRow(int band) const;
+
+        /// \brief First index into mCells of a band. The band after the last starts at the end.
+        std::size_t getBandCell(int band) const;
+
+        /// \brief CPU of each band's thread, empty if there is only one band
+        std::vector<int> getBandCpus() const;
+
+        /// \brief Write every cell of a block as big as mCells, copied from another or emptied,
+        /// each band by its own thread unless mFirstTouch is off
+        void touchCells(Cells& cells, const Cells* from) const;
+
+        /// \brief List the conductors of every tile of advance() and its halo `steps` cells wide
+        void buildBlocks(int steps, Blocks& blocks) const;
+
+        /// \brief Advance the tiles from first up to last by `steps` generations into the next
+        /// states of their cells, in scratch buffers front and back
+        void advanceBlocks(const Blocks& blocks, std::size_t first, std::size_t last, int steps,
+                           std::vector<unsigned char>& front, std::vector<unsigned char>& back);
+
+        /// \brief update() for the REFERENCE and MASKED engines
+        template <Layout L, bool Masked>
+        void updateCells();
+
+        /// \brief update() for the LOOKUP engine
+        void updateLookup();
+
+        static void setNibble(unsigned long long* words, int x, unsigned nibble);
+
+        /// \brief Six head bits of a row starting at column x, wrapping around the edges. Slow path for
+        /// the groups at the edges of the grid.
+        unsigned headBits(int row, int x) const;
+
+        int mWidth;
+        int mHeight;
+        Cells mCells;
+        Layout mLayout;
+        int mTileColumns; // Tiles across the grid in the TILES layout
+        int mThreads;
+        bool mFirstTouch; // Whether each band's thread touches its cells first
+
+        std::vector<unsigned> mInteresting; // Indices into mCells of the cells which may change
+        std::size_t mSortedCells; // Length of the sorted start of mInteresting
+        bool mEdited; // Cells set since the last flip()
+
+        Engine mEngine;
+
+        // MASKED engine state
+        std::vector<unsigned char> mWires; // Neighbours of each cell which may be conductors, indexed
+                                           // like mCells. Empty until the engine first runs.
+
+        // INCREMENTAL engine state, indexed like mCells
+        std::vector<unsigned char> mHeadCounts; // Current heads around each cell
+        std::vector<unsigned> mHeads; // Current heads
+        std::vector<unsigned> mTails; // Current tails
+        std::vector<unsigned> mFired; // Wires which are heads in the next state
+        bool mCountsValid; // Cleared whenever every cell is flipped
+        bool mCountsStepped; // Set by updateIncremental(), so the next flip() need only move electrons
+
+        // LOOKUP engine state
+        std::vector<unsigned long long> mHeadBits; // One bit per cell, mRowWords words per row
+        std::vector<unsigned long long> mNextHeadBits;
+        int mRowWords;
+        bool mHeadBitsValid; // Cleared whenever cells change outside of updateLookup()
+        std::vector<int> mGroups; // First column of each aligned group of four with interesting cells
+        std::vector<int> mGroupRows; // Start of each row in mGroups
+        bool mGroupsValid; // Cleared whenever the interesting list changes
+};
+
+#endif // GRID_HPP
@@ -0,0 +1,164 @@
+#ifndef HALONODE_HPP
+#define HALONODE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+/// \brief One node of a board split into a grid of rectangles, each run by its own process on this
+/// machine or another. A node owns a rectangle of the torus and keeps a halo k cells wide around
+/// it. The halo is only good for k generations, so every k generations the nodes send the edges of
+/// their rectangles to their four neighbours over TCP and refill their halos: the left and right
+/// columns first, then the top and bottom rows including the columns just received, which brings
+/// the corners along. While the halos are on their way, the node works out the first of the k
+/// generations for the cells which don't need them.
+///
+/// Node r is in column r % columns and row r / columns of the grid of nodes. It listens on its own
+/// port, connects to its right and lower neighbours and is connected to by the other two. A thread
+/// per connection takes in everything sent on it, so sending never waits for the neighbour to
+/// read. Every message is one sf::Packet starting with a Message byte. HELLO carries the sender's
+/// rank and the direction of the connection from the sender as a uint32 and a uint8, then the
+/// board's width and height, the number of columns and rows of nodes and the halo width as uint32.
+/// The other messages carry raw bytes: a strip of the halo row by row with a byte per cell, the
+/// totals as three uint64 with the least significant byte first, or nothing.
+class HaloNode
+{
+    public:
+        enum Message
+        {
+            HELLO = 1, // Sent once by the connecting node
+            STRIP, // Cells for the receiver's halo
+            TOTALS, // Heads, tails and electron hash summed so far
+            BYE // Nothing more will be sent
+        };
+
+        /// \brief Be node `rank` of a grid of columns x rows nodes, exchanging halos `halo` cells
+        /// wide every `halo` generations
+        HaloNode(int columns, int rows, int rank, int halo);
+
+        /// \brief Tell the neighbours this node is done and wait for them to say the same
+        ~HaloNode();
+
+        /// \brief Read where the nodes are, one host or host:port per line in rank order. Blank lines
+        /// and lines starting with // are skipped. Nodes without a line are on this machine, and
+        /// nodes without a port listen on the base port plus their rank.
+        /// \return false with a message in error if the file can't be read or is malformed
+        bool loadHosts(const std::string& filename, std::string& error);
+
+        /// \brief Load this node's rectangle and halo from a .wi file, listen on this node's port
+        /// and connect to the neighbours, waiting up to a minute for them to start
+        /// \return false with a message in error if any of it fails
+        bool start(const std::string& filename, unsigned short basePort, std::string& error);
+
+        /// \brief Advance the board by a number of generations, then add up the electrons of every node
+        /// \return false with a message in error if a neighbour goes away or breaks the protocol
+        bool run(int generations, std::string& error);
+
+        /// \brief Print this node's rectangle and electrons, and the totals of the whole board. The
+        /// electron hash of the board is the same as Grid::getStateHash() of the whole board in the
+        /// ROWS layout, however it is split.
+        void printResults(std::ostream& out) const;
+
+        /// \brief Seconds spent in run(), exchanges included
+        double getSeconds() const {return mSeconds;}
+
+    private:
+        enum Direction
+        {
+            LEFT,
+            RIGHT,
+            UP,
+            DOWN,
+            DIRECTION_COUNT
+        };
+
+        /// \brief The connection to a neighbour and the messages which arrived on it
+        struct Link
+        {
+            Link();
+
+            int neighbour; // Rank
+            std::unique_ptr<sf::TcpSocket> socket; // None if the neighbour is this node
+            std::thread receiver;
+            std::deque<std::vector<unsigned char>> inbox; // Guarded by mMutex
+            bool closed; // Guarded by mMutex
+        };
+
+        unsigned short getPort(int rank, unsigned short basePort) const;
+
+        /// \brief Connect to the right or lower neighbour and introduce this node
+        bool connect(Direction direction, unsigned short basePort, std::string& error);
+
+        /// \brief Accept the left and upper neighbours
+        bool accept(sf::TcpListener& listener, std::string& error);
+
+        /// \brief Receiver thread body: queue every message arriving from a neighbour until it says BYE
+        void listen(Direction direction);
+
+        /// \brief Send a message to a neighbour, or straight to this node's inbox if it is the neighbour
+        bool send(Direction direction, const std::vector<unsigned char>& message, std::string& error);
+
+        /// \brief Wait for the next message from a neighbour, which has to be of the given kind
+        bool receive(Direction direction, Message kind, std::vector<unsigned char>& message, std::string& error);
+
+        /// \brief Exchange thread body: refill the halos of the cells it is handed
+        void communicate();
+
+        /// \brief Send the edges of the rectangle in cells and refill the halo from the neighbours
+        bool exchange(unsigned char* cells, std::string& error);
+
+        /// \brief Copy a block of cells out to a message, or in from one
+        void copyOut(const unsigned char* cells, int left, int top, int width, int height,
+                     std::vector<unsigned char>& message) const;
+        bool copyIn(unsigned char* cells, int left, int top, int width, int height,
+                    const std::vector<unsigned char>& message, std::string& error) const;
+
+        /// \brief Advance a list of cells by one generation
+        void step(const std::vector<int>& cells, const unsigned char* current, unsigned char* next) const;
+
+        /// \brief Add up values over every node, first along the rows of nodes, then the columns
+        bool reduce(unsigned long long values[3], std::string& error);
+
+        int mNodeColumns;
+        int mNodeRows;
+        int mRank;
+        int mHalo;
+        std::vector<std::string> mHosts; // Of each rank, empty for this machine
+        std::vector<unsigned short> mPorts; // Of each rank, 0 for the base port plus the rank
+
+        int mBoardWidth;
+        int mBoardHeight;
+        int mLeft; // The rectangle this node owns
+        int mTop;
+        int mWidth;
+        int mHeight;
+        int mSpan; // Width of the rectangle and its halo, the row stride of the cells
+        std::vector<unsigned char> mFront; // Cell states of the rectangle and its halo
+        std::vector<unsigned char> mBack;
+        const unsigned char* mCells; // Whichever holds the latest generation
+        std::vector<int> mInterior; // Conductors whose neighbours are all in the rectangle
+        std::vector<int> mRim; // The other conductors, except on the outer edge of the halo
+
+        Link mLinks[DIRECTION_COUNT];
+        std::mutex mMutex;
+        std::condition_variable mChanged;
+        std::thread mExchanger;
+        unsigned char* mExchangeCells; // Handed to the exchange thread, guarded by mMutex
+        bool mExchangeDone;
+        std::string mExchangeError;
+        bool mRunning;
+
+        double mSeconds;
+        int mHeads; // In the rectangle
+        int mTails;
+        unsigned long long mTotals[3]; // Heads, tails and electron hash of the board
+};
+
+#endif // HALONODE_HPP
@@ -0,0 +1,125 @@
+#ifndef INFINITEGRID_HPP
+#define INFINITEGRID_HPP
+
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+#include "Pool.hpp"
+
+#define CHUNK_SIZE 64
+
+/// \brief Unbounded wireworld grid. Cells live in 64x64 chunks which are only allocated where there
+/// are conductors and are freed again once they are empty, so memory scales with the size of the
+/// circuit rather than its extent. Chunks are found through an open-addressing hash map keyed by
+/// chunk coordinates. Chunks and the lists of occupied cells come from pools, so editing and
+/// stepping don't go through the system allocator once warmed up. Has the same interface as Grid,
+/// except that nothing wraps around. Like Grid, it is drawn by Render.cpp.
+class InfiniteGrid
+{
+    public:
+        InfiniteGrid();
+
+        ~InfiniteGrid();
+
+        /// \brief Load a .wi file with its top left cell at the origin. Replaces the whole grid.
+        bool loadFromFile(const std::string& filename);
+
+        /// \brief Write the current cells to a .wi file. The file covers the bounding box of the cells,
+        /// so loadFromFile() reads them back moved to put that box at the origin.
+        bool saveToFile(const std::string& filename) const;
+
+        /// \brief Update the grid
+        void update();
+
+        /// \brief Draw the grid
+        void draw(sf::RenderTarget& target) const;
+        void draw(sf::RenderTarget& target, const sf::RenderStates& states) const;
+
+        /// \brief Set the next state to the current state, and free chunks left empty
+        void flip();
+
+        /// \brief Get the contents of a cell. Anywhere without a chunk is empty.
+        CellState getCell(int x, int y) const;
+
+        /// \brief Set the contents of a cell, allocating its chunk if needed
+        void setCell(int x, int y, CellState cell);
+
+        /// \brief Remove every cell
+        void clear();
+
+        /// \brief Whether any current cell is an electron head
+        bool hasHeads() const;
+
+        /// \brief Hash of where the electrons are. Two states of the same grid with the same hash
+        /// are equal, barring a collision.
+        unsigned long long getStateHash() const;
+
+        /// \brief Number of allocated chunks
+        std::size_t getChunkCount() const {return mChunks.size();}
+
+        /// \brief Allocation counters of the chunk pool and the cell list pool, shared by all grids
+        static PoolStats getChunkStats();
+        static PoolStats getCellListStats();
+
+        /// \brief Add the memory held by the chunk table, and by the chunk and cell list pools, which
+        /// are shared by all grids
+        void reportMemory(MemoryReport& report) const;
+
+    private:
+        InfiniteGrid(const InfiniteGrid&);
+        InfiniteGrid& operator=(const InfiniteGrid&);
+
+        static const int CellBlockSize = 250; // Makes a CellBlock 512 bytes
+
+        /// \brief Piece of a chunk's list of occupied cells
+        struct CellBlock
+        {
+            CellBlock* next;
+            int count;
+            unsigned short cells[CellBlockSize]; // Local indices
+        };
+
+        struct Chunk
+        {
+            int cx;
+            int cy;
+            unsigned char current[CHUNK_SIZE*CHUNK_SIZE];
+            unsigned char next[CHUNK_SIZE*CHUNK_SIZE];
+            CellBlock* cells; // The cells which aren't empty
+            CellBlock* lastBlock;
+            int conductors; // Counted by flip()
+            int heads;
+            int tails;
+            Chunk* around[9]; // 3x3 block of chunks centred on this one, null where unallocated
+        };
+
+        struct Slot
+        {
+            int cx;
+            int cy;
+            Chunk* chunk; // Null for a free slot, mTombstone for a removed one
+        };
+
+        Chunk* findChunk(int cx, int cy) const;
+        Chunk* createChunk(int cx, int cy);
+        void destroyChunk(Chunk* chunk);
+        void rehash(std::size_t capacity);
+        static void addCell(Chunk* chunk, int index);
+        static void releaseCells(CellBlock* block);
+
+        /// \brief Commit the next state of a chunk's cells, drop the ones left empty and recount
+        static void compactCells(Chunk* chunk);
+        static std::size_t hash(int cx, int cy);
+
+        /// \brief State of a cell relative to a chunk, possibly in one of its neighbours
+        static unsigned char cellAround(const Chunk* chunk, int lx, int ly);
+
+        std::vector<Slot> mSlots; // Power of two sized, linear probing
+        std::size_t mUsed; // Occupied slots including tombstones
+        std::vector<Chunk*> mChunks;
+
+        static Chunk* const mTombstone;
+};
+
+#endif // INFINITEGRID_HPP
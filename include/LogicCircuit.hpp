@@ -0,0 +1,163 @@
+#ifndef LOGICCIRCUIT_HPP
+#define LOGICCIRCUIT_HPP
+
+#include <deque>
+#include <functional>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+/// \brief Gate-level view of a wireworld grid. The conductor cells are compiled into a wire graph
+/// which is split into chains (plain wire, where an electron moves one cell per generation) and
+/// elements (the junctions between chains). Elements are matched against the standard components
+/// (diodes, OR/XOR/AND-NOT gates, fan-outs and clock loops) by probing their response to input
+/// electrons, and are then simulated as timed truth tables. Chains are simulated as delay lines,
+/// so the cost of a generation is proportional to the number of signal events rather than the
+/// number of cells.
+///
+/// Elements that are too large to tabulate, or that receive a signal while still settling from
+/// the previous one, fall back to simulating their own cells, so the result is exact. validate()
+/// cross-checks the reconstructed cells against the cell-level engine.
+class LogicCircuit
+{
+    public:
+        enum ElementKind
+        {
+            GENERIC, // Anything not matched below
+            PASSIVE, // Two ports, conducts both ways (bends, corners)
+            DIODE,
+            FANOUT, // Every port conducts to every other port
+            OR_GATE,
+            XOR_GATE,
+            ANDNOT_GATE, // A AND NOT B
+            CLOCK, // Junction closing a wire loop back on itself
+            ELEMENT_KIND_COUNT
+        };
+
+        LogicCircuit();
+
+        /// \brief Compile the current state of a grid. Replaces whatever was compiled before.
+        /// \return false with a message in error if the grid is narrower or shorter than 3 cells,
+        /// where the wrapped neighbours of a cell include the same cell more than once
+        bool extract(const Grid& grid, std::string& error);
+
+        /// \brief Advance the circuit by one generation
+        void step();
+
+        /// \brief Number of generations simulated since extract()
+        long long getGeneration() const {return mTime;}
+
+        /// \brief Write the state of every cell, row-major, as the cell engine would have it.
+        void materialize(std::vector<CellState>& cells) const;
+
+        /// \brief Compare against the current state of a grid advanced in lockstep.
+        /// \return The number of cells which differ
+        int validate(const Grid& reference) const;
+
+        /// \brief Number of elements matched as the given kind
+        int getElementCount(ElementKind kind) const;
+
+        /// \brief Print what the extraction found
+        void printSummary(std::ostream& out) const;
+
+        static const char* getKindName(ElementKind kind);
+
+    private:
+        /// \brief Output of an element in response to a batch of inputs
+        struct Response
+        {
+            int dt; // Generations after the inputs arrive
+            int port;
+        };
+
+        /// \brief Maximal run of wire cells with two neighbours which aren't touching each other.
+        /// Pulses moving from c0 towards cL-1 are direction 0, the other way is direction 1. The
+        /// end cells are owned by the element they attach to, if any.
+        struct Chain
+        {
+            std::vector<int> cells;
+            int element[2]; // Element attached to c0 and cL-1 or -1 for a dead end
+            int port[2];
+            std::deque<long long> pulses[2]; // Generation each pulse was at its starting end cell
+            long long lastArrival[2];
+        };
+
+        /// \brief Pulse annihilated by a head-on collision. Kept around until its cells settle.
+        struct DyingPulse
+        {
+            int chain;
+            int dir;
+            long long entry;
+            long long meet; // Last generation before both heads turn to tails
+            int gap; // Distance between the heads at meet, 1 or 2
+        };
+
+        struct Element
+        {
+            ElementKind kind;
+            int period; // Clock period for CLOCK elements
+
+            std::vector<int> cells; // Global cell indices
+            std::vector<int> adjStart; // Local adjacency in compressed row form
+            std::vector<int> adj;
+            std::vector<int> portCell; // Local index of the end cell of each attached chain
+            std::vector<int> portChain;
+            std::vector<int> portEnd;
+
+            std::vector<unsigned char> cur;
+            std::vector<unsigned char> next;
+            bool active; // Stepping cells; otherwise idle or driven by the table
+
+            bool tabled;
+            std::vector<std::vector<Response> > table; // Indexed by the mask of input ports
+            std::vector<int> settle; // Generations until the cells are all wire again
+
+            long long quietFrom; // The cells are all wire from this generation on
+            long long batchTime; // Last batch handled from the table
+            unsigned batchMask;
+            int serial; // Bumped to cancel pending table outputs
+        };
+
+        struct Event
+        {
+            long long time;
+            int target; // Chain for deliveries, element for table outputs
+            int index; // Direction for deliveries, port for table outputs
+            long long tag; // Pulse entry time for deliveries, element serial for table outputs
+
+            bool operator>(const Event& other) const {return time > other.time;}
+        };
+
+        typedef std::priority_queue<Event, std::vector<Event>, std::greater<Event> > EventQueue;
+
+        void classify(Element& element);
+        bool probe(const Element& element, const std::vector<int>& injectTime, std::vector<Response>& fires,
+                   int& settle) const;
+        static void stepCells(const Element& element, const std::vector<unsigned char>& cur,
+                              std::vector<unsigned char>& next);
+        void replay(const Element& element, long long time, std::vector<unsigned char>& cells) const;
+
+        void emitPulse(int chain, int dir, long long now);
+        void runTable(int element, unsigned mask, long long now);
+        void wake(int element, long long now);
+
+        int mWidth;
+        int mHeight;
+        long long mTime;
+
+        std::vector<Chain> mChains;
+        std::vector<Element> mElements;
+        std::vector<int> mOwner; // Element owning each cell or -1
+        std::vector<unsigned char> mConductor;
+        std::vector<int> mInitialHeads; // Chain cells which were heads at extraction
+
+        std::vector<int> mActive;
+        std::vector<DyingPulse> mDying;
+        EventQueue mDeliveries;
+        EventQueue mOutputs;
+};
+
+#endif // LOGICCIRCUIT_HPP
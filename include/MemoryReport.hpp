@@ -0,0 +1,38 @@
+#ifndef MEMORYREPORT_HPP
+#define MEMORYREPORT_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// \brief Tally of the memory held by each part of the program. Parts add themselves with add(),
+/// see Grid::reportMemory() for example.
+class MemoryReport
+{
+    public:
+        /// \param used Bytes holding live data
+        /// \param reserved Bytes allocated, including used and any spare capacity
+        /// \param wasted Part of used which holds nothing useful, such as duplicate entries
+        void add(const std::string& name, std::size_t used, std::size_t reserved, std::size_t wasted = 0);
+
+        std::size_t getTotalReserved() const;
+
+        /// \brief One line per part plus a total
+        void print(std::ostream& out) const;
+
+        /// \brief Everything on a single line, for printing periodically
+        void printLine(std::ostream& out) const;
+
+    private:
+        struct Item
+        {
+            std::string name;
+            std::size_t used;
+            std::size_t reserved;
+            std::size_t wasted;
+        };
+
+        std::vector<Item> mItems;
+};
+
+#endif // MEMORYREPORT_HPP
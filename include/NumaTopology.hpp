@@ -0,0 +1,48 @@
+#ifndef NUMATOPOLOGY_HPP
+#define NUMATOPOLOGY_HPP
+
+#include <cstddef>
+#include <vector>
+
+/// \brief The NUMA nodes of the machine and the CPUs this process may run on in each, read from
+/// /sys/devices/system/node on Linux. Elsewhere, or without that directory, every CPU is on node 0,
+/// threads can't be pinned and pages can't be located.
+class NumaTopology
+{
+    public:
+        NumaTopology();
+
+        /// \brief The machine, read the first time it is asked for
+        static const NumaTopology& getMachine();
+
+        /// \brief Nodes with at least one CPU this process may run on
+        int getNodeCount() const {return mNodeCount;}
+
+        /// \brief CPUs this process may run on
+        int getCpuCount() const {return static_cast<int>(mCpus.size());}
+
+        /// \brief CPU for a worker out of a number of them. The workers are spread evenly over the
+        /// CPUs in node order, so consecutive workers share a node, and more workers than CPUs
+        /// share CPUs. -1 where there is nothing to pin to.
+        int getCpu(int worker, int workers) const;
+
+        /// \brief Node of one of the CPUs this process may run on, or -1
+        int getNode(int cpu) const;
+
+        /// \brief Keep the calling thread on one CPU
+        /// \return false if it can't be pinned there
+        static bool pinThread(int cpu);
+
+        /// \brief Count the pages of a block of memory on each node, in pages[node], and the pages
+        /// not yet touched, which have no node until they are
+        /// \return false if the pages can't be located
+        static bool countPages(const void* data, std::size_t size, std::vector<std::size_t>& pages,
+                               std::size_t& untouched);
+
+    private:
+        std::vector<int> mCpus; // Sorted by node, then number
+        std::vector<int> mNodes; // Of each CPU in mCpus
+        int mNodeCount;
+};
+
+#endif // NUMATOPOLOGY_HPP
@@ -0,0 +1,178 @@
+#ifndef PAGEDGRID_HPP
+#define PAGEDGRID_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+class MemoryReport;
+
+/// \brief Wrapping wireworld grid for boards bigger than memory. The cells live in 64x64 tiles in a
+/// file mapped into memory, each tile two planes of a byte per cell: one holds the current states
+/// and update() works out the next ones into the other, so flip() only swaps them. Only the tiles
+/// with electrons and the tiles next to heads are stepped, so wire with no signal near it is never
+/// read, and tiles which have never had a conductor are never written, leaving holes in the file.
+///
+/// The tiles used most recently stay resident, up to a budget. Past it the least recently used tile
+/// is dropped from memory and left to the file. After each flip() the tiles the next update() will
+/// read which aren't resident are asked for, so the kernel reads them in while the caller does
+/// something else, rather than one at a time as update() gets to them. Needs Linux.
+///
+/// Has the same cell accessors as Grid, and the same getStateHash() as Grid in the ROWS layout.
+class PagedGrid
+{
+    public:
+        /// \brief Keep the tiles in a file at path, which is removed as soon as it is open, with at
+        /// most residentTiles of them in memory at once
+        PagedGrid(const std::string& path, std::size_t residentTiles);
+
+        ~PagedGrid();
+
+        /// \brief False where the tiles can't be mapped, which is anywhere but Linux
+        static bool isSupported();
+
+        /// \brief Bytes of file and memory each tile takes
+        static std::size_t getTileBytes() {return TileBytes;}
+
+        /// \brief Empty the grid and resize it, making a new tile file
+        /// \return false with a message in error if the file can't be made or mapped
+        bool create(int width, int height, std::string& error);
+
+        /// \brief Load a .wi file, as Grid::loadFromFile() does. One row is read at a time, so
+        /// loading takes no more memory than the resident tiles. The loaded cells are pending until
+        /// the next flip().
+        /// \return false with a message in error if the file can't be read or the grid made
+        bool loadFromFile(const std::string& filename, std::string& error);
+
+        /// \brief Update the grid
+        void update();
+
+        /// \brief Set the next state to the current state, then prefetch the tiles around the heads
+        void flip();
+
+        /// \brief Get the contents of a cell. Tiles without conductors are empty without being read.
+        CellState getCell(int x, int y) const;
+
+        /// \brief Get the state a cell will have after the next flip()
+        CellState getNextCell(int x, int y) const;
+
+        /// \brief Set the contents of a cell
+        void setCell(int x, int y, CellState cell);
+
+        /// \brief Compute the wrapped coordinates
+        int wrapX(int x) const;
+        int wrapY(int y) const;
+
+        int getWidth() const {return mWidth;}
+        int getHeight() const {return mHeight;}
+
+        /// \brief Whether any current cell is an electron head. Reads no tiles.
+        bool hasHeads() const;
+
+        /// \brief Hash of where the electrons are, the same as Grid::getStateHash() in the ROWS layout
+        unsigned long long getStateHash() const;
+
+        /// \brief Add the memory held by the tile table and the resident tiles
+        void reportMemory(MemoryReport& report) const;
+
+        /// \brief Print how many tiles there are, how many are resident and how often they were
+        /// fetched, dropped and prefetched
+        void printStats(std::ostream& out) const;
+
+    private:
+        PagedGrid(const PagedGrid&);
+        PagedGrid& operator=(const PagedGrid&);
+
+        static const int TileSize = 64;
+        static const int TileCells = TileSize*TileSize;
+        static const std::size_t TileBytes = 2*TileCells; // Two planes, a whole number of pages
+
+        struct Tile
+        {
+            int newer; // Neighbours in the list of resident tiles, -1 at the ends
+            int older;
+            unsigned mark; // Last list the tile was put on, to keep it from going on twice
+            unsigned used; // Last generation the tile was touched in
+            unsigned short conductors; // In the current plane
+            unsigned short heads;
+            unsigned short tails;
+            unsigned short nextConductors; // In the next plane, while pending
+            unsigned short nextHeads;
+            unsigned short nextTails;
+            unsigned char plane; // Which plane holds the current states
+            bool pending; // The next plane holds the next states
+            bool resident;
+            bool prefetched; // Asked for ahead of use, and not used since
+        };
+
+        /// \brief Close and unmap the tile file
+        void release();
+
+        /// \brief The planes of a tile, made the most recently used resident tile
+        unsigned char* touch(int tile) const;
+
+        /// \brief The current plane of a tile, without reading tiles which have no conductors
+        const unsigned char* getCurrent(int tile) const;
+
+        /// \brief Drop the least recently used resident tile
+        void evictOldest() const;
+
+        /// \brief Tell the kernel a tile's pages can go, or will be needed soon
+        void evict(int tile) const;
+        void prefetch(int tile) const;
+
+        /// \brief Put a tile at the head of the resident list, or take it off
+        void link(int tile) const;
+        void unlink(int tile) const;
+
+        /// \brief The tile holding a cell, and the cell's offset in each of its planes
+        int getTile(int x, int y) const {return (y/TileSize)*mTilesX + x/TileSize;}
+        static int getOffset(int x, int y) {return (y % TileSize)*TileSize + x % TileSize;}
+
+        /// \brief The tile dx, dy tiles away from another, wrapping around the edges
+        int getNeighbour(int tile, int dx, int dy) const;
+
+        /// \brief Work out the next plane of a tile from the current planes of it and the tiles
+        /// around it
+        void step(int tile);
+
+        /// \brief List the tiles update() steps: those with electrons, and those with conductors
+        /// next to heads. The rest can't change.
+        void listChanging(std::vector<int>& tiles) const;
+
+        /// \brief Add a tile to a list unless it is already on it, telling by the mark
+        void list(int tile, std::vector<int>& tiles) const;
+
+        std::string mPath;
+        std::size_t mBudget; // Resident tiles
+        int mWidth;
+        int mHeight;
+        int mTilesX;
+        int mTilesY;
+
+        int mFile;
+        unsigned char* mData; // Every tile, mapped
+        std::size_t mSize;
+
+        mutable std::vector<Tile> mTiles;
+        std::vector<int> mActive; // Tiles with electrons in the current plane
+        std::vector<int> mPending; // Tiles whose next plane has been worked out or edited
+        std::vector<int> mScratch; // The next active list, then the tiles to prefetch around
+        unsigned char mHalo[(TileSize + 2)*(TileSize + 2)]; // Current states of a tile and its border
+        mutable unsigned mMark;
+        unsigned mGeneration; // Counts update()s
+
+        mutable int mNewest; // Resident tiles, most recently used first
+        mutable int mOldest;
+        mutable std::size_t mResident;
+
+        // Counters
+        mutable unsigned long long mFaults; // Tiles touched when they weren't resident
+        mutable unsigned long long mEvictions;
+        mutable unsigned long long mPrefetches;
+        mutable unsigned long long mPrefetchHits; // Prefetched tiles used before being dropped
+};
+
+#endif // PAGEDGRID_HPP
@@ -0,0 +1,46 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+/// \brief Hardware performance counters of the calling thread and of the threads it starts once the
+/// counters exist, such as the bands of a blocked advance(), read through Linux perf_event_open.
+/// Threads which were already running aren't counted. Elsewhere, or when the kernel refuses (see
+/// /proc/sys/kernel/perf_event_paranoid), the counters are unavailable and read as zero. Counters
+/// which the kernel had to multiplex are scaled up to the whole measured interval.
+class PerfCounters
+{
+    public:
+        enum Counter
+        {
+            CYCLES,
+            INSTRUCTIONS,
+            L1D_MISSES, // L1 data cache read misses
+            LLC_MISSES, // Last level cache misses
+            BRANCH_MISSES,
+            COUNTER_COUNT
+        };
+
+        PerfCounters();
+
+        ~PerfCounters();
+
+        bool isAvailable(Counter counter) const {return mFds[counter] >= 0;}
+
+        /// \brief True if at least one counter could be opened
+        bool isAvailable() const;
+
+        /// \brief Reset and start counting
+        void start();
+
+        /// \brief Stop counting and add what was counted since start() to totals
+        void stop(unsigned long long totals[COUNTER_COUNT]);
+
+        static const char* getCounterName(Counter counter);
+
+    private:
+        PerfCounters(const PerfCounters&);
+        PerfCounters& operator=(const PerfCounters&);
+
+        int mFds[COUNTER_COUNT];
+};
+
+#endif // PERFCOUNTERS_HPP
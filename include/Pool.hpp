@@ -0,0 +1,174 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/// \brief Allocation counters of a Pool
+struct PoolStats
+{
+    std::size_t slabs; // Slabs taken from the system allocator
+    std::size_t allocations; // Objects handed out by create()
+    std::size_t frees; // Objects given back with destroy()
+
+    std::size_t getLive() const {return allocations - frees;}
+};
+
+/// \brief Allocator for fixed-size objects of type T. Objects are carved out of slabs of
+/// SlabObjects blocks and freed blocks are kept for reuse, so once a workload has warmed up
+/// create() and destroy() no longer touch the system allocator. Each thread keeps its own cache of
+/// free blocks and only takes the shared lock to move a batch of them at a time. Slabs are never
+/// returned to the system.
+template <typename T, std::size_t SlabObjects = 64>
+class Pool
+{
+    public:
+        /// \brief Default-initialise a new object
+        static T* create()
+        {
+            Cache& local = cache();
+            if (!local.free)
+                local.refill();
+
+            Block* block = local.free;
+            local.free = block->next;
+            local.count--;
+            shared().allocations.fetch_add(1, std::memory_order_relaxed);
+
+            return new (&block->storage) T;
+        }
+
+        static void destroy(T* object)
+        {
+            if (!object)
+                return;
+
+            object->~T();
+            Block* block = reinterpret_cast<Block*>(object);
+
+            Cache& local = cache();
+            block->next = local.free;
+            local.free = block;
+            if (++local.count >= 2*BatchSize)
+                local.flush(BatchSize);
+            shared().frees.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// \brief Bytes taken from the system allocator by each slab
+        static std::size_t getSlabBytes() {return SlabObjects*sizeof(Block);}
+
+        static PoolStats getStats()
+        {
+            Shared& store = shared();
+            PoolStats stats;
+            stats.slabs = store.slabs.load(std::memory_order_relaxed);
+            stats.allocations = store.allocations.load(std::memory_order_relaxed);
+            stats.frees = store.frees.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        static const std::size_t BatchSize = SlabObjects < 32 ? SlabObjects : 32;
+
+        union Block
+        {
+            Block* next;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        };
+
+        /// \brief Blocks and slabs shared between threads
+        struct Shared
+        {
+            Shared() : free(0), slabs(0), allocations(0), frees(0) {}
+
+            ~Shared()
+            {
+                for (Block* slab : slabList)
+                    delete[] slab;
+            }
+
+            std::mutex mutex;
+            Block* free;
+            std::vector<Block*> slabList;
+            std::atomic<std::size_t> slabs;
+            std::atomic<std::size_t> allocations;
+            std::atomic<std::size_t> frees;
+        };
+
+        /// \brief Free blocks owned by one thread. Handed back when the thread exits.
+        struct Cache
+        {
+            Cache() : free(0), count(0)
+            {
+                shared(); // Make sure the shared store outlives the caches
+            }
+
+            ~Cache()
+            {
+                flush(count);
+            }
+
+            /// \brief Take a batch of blocks from the shared store, allocating a slab if it is empty
+            void refill()
+            {
+                Shared& store = shared();
+                std::lock_guard<std::mutex> lock(store.mutex);
+                if (!store.free)
+                {
+                    Block* slab = new Block[SlabObjects];
+                    store.slabList.push_back(slab);
+                    store.slabs.fetch_add(1, std::memory_order_relaxed);
+                    for (std::size_t i = 0; i < SlabObjects; i++)
+                    {
+                        slab[i].next = store.free;
+                        store.free = &slab[i];
+                    }
+                }
+
+                for (std::size_t i = 0; i < BatchSize && store.free; i++)
+                {
+                    Block* block = store.free;
+                    store.free = block->next;
+                    block->next = free;
+                    free = block;
+                    count++;
+                }
+            }
+
+            /// \brief Hand blocks back to the shared store
+            void flush(std::size_t blocks)
+            {
+                Shared& store = shared();
+                std::lock_guard<std::mutex> lock(store.mutex);
+                for (; blocks > 0 && free; blocks--)
+                {
+                    Block* block = free;
+                    free = block->next;
+                    block->next = store.free;
+                    store.free = block;
+                    count--;
+                }
+            }
+
+            Block* free;
+            std::size_t count;
+        };
+
+        static Shared& shared()
+        {
+            static Shared store;
+            return store;
+        }
+
+        static Cache& cache()
+        {
+            static thread_local Cache local;
+            return local;
+        }
+};
+
+#endif // POOL_HPP
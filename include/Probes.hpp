@@ -0,0 +1,127 @@
+#ifndef PROBES_HPP
+#define PROBES_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+class InfiniteGrid;
+class MemoryReport;
+
+/// \brief Named cells whose electron heads are logged with the generation they were seen in. Meant
+/// for reading the outputs of a circuit in headless runs: sample() only looks at the probed cells,
+/// so it adds next to nothing to a generation.
+///
+/// Probes named like `out[3]` form a bus called `out`, with the number as the bit. Heads arriving
+/// on a bus in the same generation are decoded as one binary word.
+class Probes
+{
+    public:
+        /// \brief A head seen on a probe
+        struct Event
+        {
+            long long generation;
+            int probe;
+        };
+
+        /// \brief Add a probe. Names don't have to be unique.
+        void add(const std::string& name, int x, int y);
+
+        /// \brief Add a probe from text in the form `name=x,y`
+        /// \return false with a message in error if the text is malformed
+        bool parse(const std::string& text, std::string& error);
+
+        /// \brief Read probes, one per line: a name followed by the coordinates, e.g. `out[0] 12,40`.
+        /// Blank lines and lines starting with // are skipped.
+        /// \return false with a message in error if the file can't be read or is malformed
+        bool loadFromFile(const std::string& filename, std::string& error);
+
+        /// \brief Check that every probe is on a wire of a board. A probe anywhere else could never
+        /// see a head.
+        /// \return false with a message in error naming the first probe which isn't
+        template <typename Board>
+        bool validate(const Board& board, std::string& error) const
+        {
+            for (const Probe& probe : mProbes)
+            {
+                if (!isInside(board, probe.x, probe.y) || board.getCell(probe.x, probe.y) == NONE)
+                {
+                    error = "Probe " + probe.name + " is not on a wire";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /// \brief Log a head on any probe of a board which has just reached the given generation
+        /// \return Whether any probe saw a head
+        template <typename Board>
+        bool sample(const Board& board, long long generation)
+        {
+            bool fired = false;
+            for (std::size_t i = 0; i < mProbes.size(); i++)
+            {
+                if (board.getCell(mProbes[i].x, mProbes[i].y) == HEAD)
+                {
+                    Event event = {generation, static_cast<int>(i)};
+                    mEvents.push_back(event);
+                    fired = true;
+                }
+            }
+            return fired;
+        }
+
+        bool isEmpty() const {return mProbes.empty();}
+        std::size_t getCount() const {return mProbes.size();}
+        const std::vector<Event>& getEvents() const {return mEvents;}
+        const std::string& getName(int probe) const {return mProbes[probe].name;}
+
+        /// \brief Forget the logged events, keeping the probes
+        void clearEvents() {mEvents.clear();}
+
+        /// \brief One line per event: the generation and the probe name
+        void writeEvents(std::ostream& out) const;
+
+        /// \brief One line per generation in which a bus saw heads: the generation, the bus name and
+        /// the word read off its bits, in decimal and binary
+        void writeDecoded(std::ostream& out) const;
+
+        /// \brief For each probe, the number of heads seen, the first and last generation and the
+        /// gap between the last two
+        void printSummary(std::ostream& out) const;
+
+        /// \brief Add the memory held by the probes and the event log
+        void reportMemory(MemoryReport& report) const;
+
+    private:
+        struct Probe
+        {
+            std::string name;
+            int x;
+            int y;
+            int bus; // Index into mBuses or -1
+            int bit;
+        };
+
+        struct Bus
+        {
+            std::string name;
+            int width; // Highest bit plus one
+        };
+
+        /// \brief Whether a cell is on a board. An InfiniteGrid has no edges.
+        template <typename Board>
+        static bool isInside(const Board& board, int x, int y)
+        {
+            return x >= 0 && y >= 0 && x < board.getWidth() && y < board.getHeight();
+        }
+        static bool isInside(const InfiniteGrid&, int, int) {return true;}
+
+        std::vector<Probe> mProbes;
+        std::vector<Bus> mBuses;
+        std::vector<Event> mEvents;
+};
+
+#endif // PROBES_HPP
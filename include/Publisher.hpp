@@ -0,0 +1,131 @@
+#ifndef PUBLISHER_HPP
+#define PUBLISHER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#include "Grid.hpp"
+#include "Trace.hpp"
+
+/// \brief Streams a board to viewers over TCP. The simulation offers the board after every
+/// generation, and at most `fps` times a second a copy of it is handed to the publisher's thread,
+/// which sends each viewer the cells changed since the last frame it sent, however many
+/// generations ago that was. A viewer that connects gets a keyframe first. Nothing waits for the
+/// network: the sockets never block, each viewer has at most one frame on its way and skips the
+/// frames which come up meanwhile, and a viewer which takes more than a few seconds over a frame is
+/// dropped. The simulation doesn't wait for the thread either: if it is still busy with the
+/// previous frame, the offer is skipped and the changes go out with the next one. When the board
+/// changes size, as when a control client loads another, every viewer is sent a keyframe again.
+///
+/// Each frame is one sf::Packet: a Frame byte, the generation, the width and the height as uint32,
+/// then the changes as a string (a uint32 length and the bytes). See encode() for the changes.
+class Publisher
+{
+    public:
+        enum Frame
+        {
+            KEYFRAME = 1, // Changes from an empty board
+            DELTA // Changes from the previous frame
+        };
+
+        Publisher();
+
+        ~Publisher();
+
+        /// \brief Listen for viewers on a port. Boards which have no size of their own are streamed at
+        /// the given size.
+        bool start(unsigned short port, int width, int height, float fps);
+
+        /// \brief Disconnect the viewers and stop the thread
+        void stop();
+
+        /// \brief Offer the current state of a board. Cheap unless a frame is due.
+        template <typename Board>
+        void offer(const Board& board, long long generation);
+
+        /// \brief Encode the changes from one board state to another, row-major with one byte per
+        /// cell. The changes are runs of cells, each written as the number of cells skipped since
+        /// the last run and the length of the run, both as LEB128 varints, followed by the new
+        /// states of the run packed four to a byte, lowest bits first. Short gaps are folded into
+        /// the runs.
+        static void encode(const std::vector<unsigned char>& from, const std::vector<unsigned char>& to,
+                           std::string& out);
+
+        /// \brief Apply changes made by encode() to a board state
+        /// \param changed Set to the index of every cell written
+        /// \return false if the changes are malformed or don't fit the state
+        static bool decode(const std::string& changes, std::vector<unsigned char>& cells, std::vector<int>& changed);
+
+    private:
+        /// \brief Publisher thread: accepts viewers, and encodes and sends each frame handed over
+        void publish();
+
+        /// \brief Copy the current states of the published part of a board into a frame, row-major,
+        /// and set the size of the frame
+        template <typename Board>
+        void copyCells(const Board& board, std::vector<unsigned char>& cells, int& width, int& height) const;
+        void copyCells(const Grid& board, std::vector<unsigned char>& cells, int& width, int& height) const;
+
+        sf::TcpListener mListener;
+        int mWidth; // Of boards which have no size of their own
+        int mHeight;
+        std::chrono::steady_clock::duration mInterval;
+        std::chrono::steady_clock::time_point mNextFrame;
+        std::atomic<bool> mHasViewers; // Read by offer() without the lock
+
+        std::thread mThread;
+        std::mutex mMutex;
+        std::condition_variable mChanged;
+        std::vector<unsigned char> mFrame; // Handed over by offer(), guarded by mMutex
+        long long mFrameGeneration;
+        int mFrameWidth;
+        int mFrameHeight;
+        bool mHasFrame;
+        bool mRunning;
+};
+
+template <typename Board>
+void Publisher::offer(const Board& board, long long generation)
+{
+    if (!mHasViewers.load(std::memory_order_relaxed))
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < mNextFrame)
+        return;
+
+    // Never wait for the publisher thread
+    std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+    if (!lock.owns_lock() || mHasFrame)
+        return;
+
+    TraceScope trace("publish", "io");
+    copyCells(board, mFrame, mFrameWidth, mFrameHeight);
+    mFrameGeneration = generation;
+    mHasFrame = true;
+    mNextFrame = now + mInterval;
+    mChanged.notify_all();
+}
+
+template <typename Board>
+void Publisher::copyCells(const Board& board, std::vector<unsigned char>& cells, int& width, int& height) const
+{
+    width = mWidth;
+    height = mHeight;
+    cells.resize(mWidth*mHeight);
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+            cells[y*mWidth + x] = board.getCell(x, y);
+    }
+}
+
+#endif // PUBLISHER_HPP
@@ -0,0 +1,33 @@
+#ifndef QUEUEDSOCKET_HPP
+#define QUEUEDSOCKET_HPP
+
+#include <string>
+
+#include <SFML/Network.hpp>
+
+/// \brief Non-blocking TCP socket which queues the packets sent on it and writes them out as the
+/// socket takes them, so a peer which stops reading never holds up the thread sending to it.
+/// sf::TcpSocket::send() can't do this: when a non-blocking socket fills up part way through a
+/// packet, it doesn't say how much went out. Packets are framed as sf::TcpSocket frames them, a
+/// 32-bit big-endian byte count and then the data, so the peer reads them with receive() as usual.
+class QueuedSocket : public sf::TcpSocket
+{
+    public:
+        QueuedSocket();
+
+        /// \brief Add a packet to the end of the queue. Nothing is written until flush().
+        void queue(const sf::Packet& packet);
+
+        /// \brief Write as much of the queue as the socket takes without waiting
+        /// \return false if the connection is gone
+        bool flush();
+
+        /// \brief Whether some of the queue has yet to go out
+        bool isSending() const {return mSent < mQueue.size();}
+
+    private:
+        std::string mQueue;
+        std::size_t mSent; // Bytes of mQueue written
+};
+
+#endif // QUEUEDSOCKET_HPP
@@ -0,0 +1,147 @@
+#ifndef RUNUNTIL_HPP
+#define RUNUNTIL_HPP
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Probes.hpp"
+#include "Trace.hpp"
+
+/// \brief Steps a board until one of a set of conditions holds: a probe sees a head, no heads are
+/// left, the state repeats, or a number of generations have run. The conditions are checked after
+/// each generation inside the loop, and the ones which weren't asked for cost nothing.
+///
+/// Repeats are found with Brent's algorithm on Board::getStateHash(), so only one hash is kept.
+/// The period found is exact, but the run can go on for up to twice as long as the generation of
+/// the first repeat before it is noticed.
+class RunUntil
+{
+    public:
+        /// \brief Why run() stopped
+        enum Reason
+        {
+            LIMIT, // Ran the number of generations given
+            PROBE,
+            QUIESCENT, // No heads left
+            REPEAT
+        };
+
+        /// \brief Run at most a number of generations, and stop on nothing else until told to
+        explicit RunUntil(long long limit);
+
+        /// \brief Add a condition: `quiet`, `repeat`, `probe` for any probe, `probe=name` for the
+        /// probes with that name, or a number of generations, which lowers the limit
+        /// \return false with a message in error if the condition isn't one of those
+        bool parse(const std::string& text, std::string& error);
+
+        /// \brief Check that every probe named in a condition exists
+        /// \return false with a message in error naming the first one which doesn't
+        bool validate(const Probes& probes, std::string& error) const;
+
+        long long getLimit() const {return mLimit;}
+
+        /// \brief Call a function with the generation number after each generation, e.g. to hand the
+        /// board to a Publisher. An empty function turns it off.
+        void setObserver(const std::function<void(long long)>& observer) {mObserver = observer;}
+        bool hasObserver() const {return static_cast<bool>(mObserver);}
+
+        /// \brief Whether anything other than the limit can stop the run
+        bool hasConditions() const {return mQuiescent || mRepeat || mAnyProbe || !mProbeNames.empty();}
+
+        /// \brief Step a board, logging heads on the probes, until a condition holds. The board is
+        /// checked for no heads before the first step as well.
+        /// \param start Generation the board is at. The limit counts from here.
+        template <typename Board>
+        Reason run(Board& board, Probes& probes, long long start = 0);
+
+        /// \brief Generation the last run() stopped at
+        long long getGeneration() const {return mGeneration;}
+
+        /// \brief Print why and when the last run() stopped
+        void printResult(std::ostream& out, const Probes& probes) const;
+
+    private:
+        /// \brief Whether a probe asked for logged one of the heads from the given event on
+        bool probeFired(const Probes& probes, std::size_t firstEvent);
+
+        long long mLimit;
+        bool mQuiescent;
+        bool mRepeat;
+        bool mAnyProbe;
+        std::vector<std::string> mProbeNames;
+        std::function<void(long long)> mObserver;
+
+        // Result of the last run
+        Reason mReason;
+        long long mGeneration;
+        long long mPeriod; // Of the repeat
+        int mProbe; // Probe which stopped the run
+};
+
+template <typename Board>
+RunUntil::Reason RunUntil::run(Board& board, Probes& probes, long long start)
+{
+    bool watchProbes = mAnyProbe || !mProbeNames.empty();
+
+    // Brent's algorithm: compare each hash with the one saved at the last power of two steps
+    unsigned long long saved = mRepeat ? board.getStateHash() : 0;
+    long long power = 1;
+    long long steps = 0;
+
+    mGeneration = start;
+    mReason = LIMIT;
+    if (mQuiescent && !board.hasHeads())
+    {
+        mReason = QUIESCENT;
+        return mReason;
+    }
+
+    while (mGeneration - start < mLimit)
+    {
+        {
+            TraceScope trace("generation", "sim");
+            board.update();
+            board.flip();
+        }
+        mGeneration++;
+        if (mObserver)
+            mObserver(mGeneration);
+
+        std::size_t logged = probes.getEvents().size();
+        if (probes.sample(board, mGeneration) && watchProbes && probeFired(probes, logged))
+        {
+            mReason = PROBE;
+            break;
+        }
+
+        if (mQuiescent && !board.hasHeads())
+        {
+            mReason = QUIESCENT;
+            break;
+        }
+
+        if (mRepeat)
+        {
+            unsigned long long hash = board.getStateHash();
+            steps++;
+            if (hash == saved)
+            {
+                mPeriod = steps;
+                mReason = REPEAT;
+                break;
+            }
+            if (steps == power)
+            {
+                saved = hash;
+                power *= 2;
+                steps = 0;
+            }
+        }
+    }
+
+    return mReason;
+}
+
+#endif // RUNUNTIL_HPP
@@ -0,0 +1,62 @@
+#ifndef SLABRUNNER_HPP
+#define SLABRUNNER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+/// \brief Runs a board too big for one process as horizontal slabs, each owned by its own worker
+/// process. A worker loads only its slab of the .wi file, plus a halo row above and below, and
+/// never sees the rest of the board. After each update() the workers put their first and last rows
+/// in POSIX shared memory, wait at a barrier and copy their neighbours' rows into their halos before
+/// flipping. The barrier sleeps on a futex, so this needs Linux.
+class SlabRunner
+{
+    public:
+        /// \brief Split the board in filename into a number of slabs of nearly equal height
+        SlabRunner(const std::string& filename, int slabs);
+
+        /// \brief Choose the kernel each worker's grid uses. REFERENCE and MASKED suit slabs best:
+        /// the halos are edited every generation, which makes the other engines rebuild their tables.
+        void setEngine(Grid::Engine engine) {mEngine = engine;}
+
+        /// \brief False where the workers can't run, which is anywhere but Linux
+        static bool isSupported();
+
+        /// \brief Start a worker per slab, advance the board by a number of generations and collect
+        /// the results
+        /// \return false with a message in error if the board can't be split or a worker fails
+        bool run(int generations, std::string& error);
+
+        /// \brief Print each slab's rows, electrons and peak memory, the time taken and a checksum of
+        /// the final cells, the same as the benchmark's for the whole board
+        void printResults(std::ostream& out) const;
+
+        /// \brief Seconds spent stepping, from when every worker had loaded its slab
+        double getSeconds() const {return mSeconds;}
+
+    private:
+        struct Slab
+        {
+            int firstRow;
+            int rows;
+
+            // Results
+            int heads;
+            int tails;
+            std::size_t peakRss; // Of the worker process, in bytes
+        };
+
+        std::string mFilename;
+        int mSlabCount;
+        Grid::Engine mEngine;
+        int mWidth;
+        int mHeight;
+        std::vector<Slab> mSlabs;
+        double mSeconds;
+        unsigned long long mChecksum;
+};
+
+#endif // SLABRUNNER_HPP
@@ -0,0 +1,84 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Grid.hpp"
+
+/// \brief Runs many variants of one circuit which differ only in where the electrons start. The
+/// wires are compiled once into a shared, read-only neighbour table and each variant only owns an
+/// array of conductor states, so variants are cheap to set up and run side by side on all cores.
+class Sweep
+{
+    public:
+        /// \brief Ways run() can advance the variants. They all give the same result.
+        enum Engine
+        {
+            SCALAR, // One byte per conductor per variant
+            LANES // 64 variants at once, one bit per variant in a head word and a tail word per conductor
+        };
+
+        /// \brief Compile the conductors of a grid. Its current cells are the starting state that
+        /// each variant's edits are applied to.
+        explicit Sweep(const Grid& base);
+
+        /// \brief Read variants, one per line: a name followed by cells to set, written as the
+        /// state's .wi character and the coordinates, e.g. `fast @12,40 ~11,40 #30,7`. Blank lines
+        /// and lines starting with // are skipped. Only conductors can be set.
+        /// \return false with a message in error if the file can't be read or is malformed
+        bool loadVariants(const std::string& filename, std::string& error);
+
+        std::size_t getVariantCount() const {return mVariants.size();}
+
+        void setEngine(Engine engine) {mEngine = engine;}
+        Engine getEngine() const {return mEngine;}
+
+        /// \brief Advance every variant by a number of generations, spread over several threads
+        void run(int generations, int threads);
+
+        /// \brief Print the electrons left in each variant and a checksum of its cells
+        void printResults(std::ostream& out) const;
+
+    private:
+        struct Edit
+        {
+            int conductor;
+            unsigned char state;
+        };
+
+        struct Variant
+        {
+            std::string name;
+            std::vector<Edit> edits;
+
+            // Results
+            int heads;
+            int tails;
+            unsigned long long checksum;
+        };
+
+        /// \brief Run one variant from its starting state, in buffers owned by the calling thread
+        void runVariant(Variant& variant, int generations, std::vector<unsigned char>& cur,
+                        std::vector<unsigned char>& scratch) const;
+
+        /// \brief Run up to 64 variants starting at first, one per bit lane
+        void runLanes(std::size_t first, int generations, std::vector<unsigned long long>& planes,
+                      std::vector<unsigned long long>& scratch);
+
+        /// \brief Fill in the results of a variant from its final conductor states
+        static void summarize(Variant& variant, const std::vector<unsigned char>& cells);
+
+        int mWidth;
+        int mHeight;
+        std::vector<int> mCells; // Grid index of each conductor
+        std::vector<int> mConductor; // Conductor at each grid index or -1
+        std::vector<int> mNeighborStart; // Conductor neighbours in compressed row form
+        std::vector<int> mNeighbors;
+        std::vector<unsigned char> mInitial;
+        std::vector<Variant> mVariants;
+        Engine mEngine;
+};
+
+#endif // SWEEP_HPP
@@ -0,0 +1,81 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+class MemoryReport;
+
+/// \brief Timeline of what the program spent its time on, written in the Chrome trace event format
+/// (load it in chrome://tracing or Perfetto). Each thread records into its own buffer, so recording
+/// doesn't take a lock. Event names and categories must be string literals, since only the pointers
+/// are stored. Recording is off unless start() was called.
+class Trace
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /// \brief Discard anything recorded so far and start recording
+        static void start();
+
+        /// \brief Stop recording and write the events out. Other threads should be idle by then.
+        static bool write(const std::string& filename);
+
+        /// \brief Whether recording is on. Safe to call from any thread.
+        static bool isEnabled() {return mEnabled.load(std::memory_order_relaxed);}
+
+        /// \brief Add the memory held by the event buffers waiting to be written. Safe while other
+        /// threads are recording.
+        static void reportMemory(MemoryReport& report);
+
+        /// \brief Record an event which ran from begin to end on the calling thread
+        static void record(const char* name, const char* category, Clock::time_point begin, Clock::time_point end);
+
+    private:
+        static std::atomic<bool> mEnabled; // Read by every thread which records
+};
+
+/// \brief Records an event covering its own lifetime
+class TraceScope
+{
+    public:
+        TraceScope(const char* name, const char* category) : mName(name), mCategory(category), mActive(Trace::isEnabled())
+        {
+            if (mActive)
+                mBegin = Trace::Clock::now();
+        }
+
+        ~TraceScope()
+        {
+            if (mActive && Trace::isEnabled())
+                Trace::record(mName, mCategory, mBegin, Trace::Clock::now());
+        }
+
+    private:
+        TraceScope(const TraceScope&);
+        TraceScope& operator=(const TraceScope&);
+
+        const char* mName;
+        const char* mCategory;
+        bool mActive;
+        Trace::Clock::time_point mBegin;
+};
+
+/// \brief Records while in scope and writes the trace out on leaving it. Does nothing if the file
+/// name is empty.
+class TraceSession
+{
+    public:
+        explicit TraceSession(const std::string& filename);
+
+        ~TraceSession();
+
+    private:
+        TraceSession(const TraceSession&);
+        TraceSession& operator=(const TraceSession&);
+
+        std::string mFilename;
+};
+
+#endif // TRACE_HPP
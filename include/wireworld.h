@@ -0,0 +1,126 @@
+#ifndef WIREWORLD_H
+#define WIREWORLD_H
+
+/* C interface to the headless simulation library (libwireworld). It wraps a Grid with its probes,
+ * so it can be used from C and from anything with a C foreign function interface, without SFML.
+ * Functions returning int report failure with 0 unless noted otherwise. No C++ exception gets
+ * out: running out of memory is a failure like any other, after which the grid may be part way
+ * through a step and is best destroyed. The ABI only grows: existing functions and enum values
+ * keep their meaning, and WW_ABI_VERSION goes up when functions are added or start returning a
+ * result. */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(WIREWORLD_SHARED)
+#   ifdef WIREWORLD_BUILD
+#       define WW_API __declspec(dllexport)
+#   else
+#       define WW_API __declspec(dllimport)
+#   endif
+#elif defined(__GNUC__)
+#   define WW_API __attribute__((visibility("default")))
+#else
+#   define WW_API
+#endif
+
+#define WW_ABI_VERSION 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cell states, the same values as CellState */
+enum
+{
+    WW_NONE,
+    WW_WIRE,
+    WW_HEAD,
+    WW_TAIL
+};
+
+/* Kernels for ww_step(), the same values as Grid::Engine */
+enum
+{
+    WW_ENGINE_REFERENCE,
+    WW_ENGINE_LOOKUP,
+    WW_ENGINE_MASKED,
+    WW_ENGINE_INCREMENTAL
+};
+
+/* Why ww_run_until() stopped, the same values as RunUntil::Reason */
+enum
+{
+    WW_STOP_LIMIT,
+    WW_STOP_PROBE,
+    WW_STOP_QUIESCENT,
+    WW_STOP_REPEAT
+};
+
+typedef struct ww_grid ww_grid;
+
+/* A head seen by a probe, laid out like Probes::Event */
+typedef struct ww_probe_event
+{
+    long long generation;
+    int probe;
+} ww_probe_event;
+
+/* The WW_ABI_VERSION the library was built with */
+WW_API int ww_abi_version(void);
+
+/* Create an empty wrapping grid, or load one from a .wi file. NULL on failure. */
+WW_API ww_grid* ww_create(int width, int height);
+WW_API ww_grid* ww_load(const char* filename);
+WW_API void ww_destroy(ww_grid* grid);
+
+/* Write the current cells to a .wi file */
+WW_API int ww_save(const ww_grid* grid, const char* filename);
+
+WW_API int ww_width(const ww_grid* grid);
+WW_API int ww_height(const ww_grid* grid);
+
+/* Choose the kernel for ww_step(), one of WW_ENGINE_*. Any other value is refused, leaving the
+ * engine as it was. */
+WW_API int ww_set_engine(ww_grid* grid, int engine);
+
+/* Generations stepped since the grid was created or loaded */
+WW_API long long ww_generation(const ww_grid* grid);
+
+/* Current state of a cell, WW_NONE outside the grid */
+WW_API int ww_get_cell(const ww_grid* grid, int x, int y);
+
+/* Set a cell, ignored (returning 0) outside the grid. Edits take effect at the next ww_commit()
+ * or step. */
+WW_API int ww_set_cell(ww_grid* grid, int x, int y, int state);
+WW_API int ww_commit(ww_grid* grid);
+
+/* Step one generation at a time, logging heads on the probes */
+WW_API int ww_step(ww_grid* grid, long long generations);
+
+/* Step in temporally blocked passes of depth generations, from 1 to 64. A few generations at a
+ * time is usually fastest. Probes see nothing. A negative number of generations is refused. */
+WW_API int ww_advance(ww_grid* grid, long long generations, int depth);
+
+/* Step until a condition holds or limit generations have run. conditions is a comma separated
+ * list as taken by --until (quiet, repeat, probe, probe=name or a generation count), or NULL.
+ * Returns a WW_STOP_ value, -1 if the conditions are malformed, or -2 if memory ran out. */
+WW_API int ww_run_until(ww_grid* grid, long long limit, const char* conditions);
+
+/* The cells in place, row-major, without copying. Each cell is stride bytes and its first byte
+ * is its current state. Valid until the grid is destroyed. */
+WW_API const unsigned char* ww_cells(const ww_grid* grid, size_t* stride);
+
+/* Watch a wire cell. Returns the probe's index, or -1 if the cell isn't a wire, the name is NULL
+ * or memory ran out. */
+WW_API int ww_add_probe(ww_grid* grid, const char* name, int x, int y);
+WW_API const char* ww_probe_name(const ww_grid* grid, int probe);
+
+/* Heads seen by the probes so far, in place. Valid until the next step or clear. */
+WW_API const ww_probe_event* ww_probe_events(const ww_grid* grid, size_t* count);
+WW_API void ww_clear_probe_events(ww_grid* grid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIREWORLD_H */
@@ -1,235 +1,545 @@
-#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
 #include <SFML/System.hpp>
 
-#define TILE_SIZE 16
-
-enum CellState
-{
-    NONE,
-    WIRE,
-    HEAD,
-    TAIL
-};
+#include "Benchmark.hpp"
+#include "ControlServer.hpp"
+#include "FrameProfiler.hpp"
+#include "Grid.hpp"
+#include "HaloNode.hpp"
+#include "InfiniteGrid.hpp"
+#include "LogicCircuit.hpp"
+#include "MemoryReport.hpp"
+#include "PagedGrid.hpp"
+#include "PerfCounters.hpp"
+#include "Probes.hpp"
+#include "Publisher.hpp"
+#include "RunUntil.hpp"
+#include "SlabRunner.hpp"
+#include "Sweep.hpp"
+#include "Trace.hpp"
 
 sf::View view;
 
-/// \brief Represents a wireworld grid. Responsible for maintaining, updating, and rendering the
-/// current state. Also, this representation of wireworld wraps both vertically and horizontally.
-class Grid
+/// \brief Run the gate-level simulation without a window. If validateEvery is set, the cell engine
+/// is advanced alongside it and the two are compared every validateEvery generations.
+int runLogic(Grid& grid, int generations, int validateEvery)
 {
-    public:
-        Grid(int width, int height) : mWidth(width), mHeight(height), mCells(mWidth*mHeight, Cell{NONE, NONE}),
-            mRect(sf::Vector2f(TILE_SIZE, TILE_SIZE))
-        {
-        }
+    grid.flip(); // Commit the loaded cells
 
-        ~Grid()
-        {
-        }
+    sf::Clock clock;
+    LogicCircuit circuit;
+    std::string error;
+    if (!circuit.extract(grid, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+    std::cout << "Extracted in " << clock.restart().asSeconds() << "s\n";
+    circuit.printSummary(std::cout);
 
-        /// \brief Update the grid
-        void update()
-        {
-            for (auto& pos : mInteresting)
-            {
-                int x = pos.x;
-                int y = pos.y;
+    sf::Time logicTime;
+    for (int generation = 1; generation <= generations; generation++)
+    {
+        clock.restart();
+        circuit.step();
+        logicTime += clock.getElapsedTime();
 
-                int cell = getCell(x, y);
+        if (validateEvery > 0)
+        {
+            grid.update();
+            grid.flip();
 
-                switch (cell)
+            if (generation % validateEvery == 0)
+            {
+                int mismatches = circuit.validate(grid);
+                if (mismatches > 0)
                 {
-                    case WIRE: // wire logic
-                    {
-                        int neighbors = 0; // Number of neighbor electron heads
-
-                        if (getCell(wrapX(x-1), wrapY(y-1)) == HEAD) neighbors++; // top left
-                        if (getCell(x, wrapY(y-1)) == HEAD) neighbors++; // top mid
-                        if (getCell(wrapX(x+1), wrapY(y-1)) == HEAD) neighbors++; // top right
-
-                        if (getCell(wrapX(x-1), y) == HEAD) neighbors++; // mid left
-                        if (getCell(wrapX(x+1), y) == HEAD) neighbors++; // mid right
-
-                        if (getCell(wrapX(x-1), wrapY(y+1)) == HEAD) neighbors++; // bot left
-                        if (getCell(x, wrapY(y+1)) == HEAD) neighbors++; // bot mid
-                        if (getCell(wrapX(x+1), wrapY(y+1)) == HEAD) neighbors++; // bot right
-
-                        if (neighbors == 1 || neighbors == 2)
-                            setCell(x, y, HEAD); // becomes electron head
-
-                        break;
-                    }
-
-                    case HEAD: // electron head logic
-                    {
-                        setCell(x, y, TAIL);
-                        break;
-                    }
-
-                    case TAIL: // electron tail logic
-                    {
-                        setCell(x, y, WIRE);
-                        break;
-                    }
+                    std::cout << "Generation " << generation << ": " << mismatches << " cells differ from the cell engine\n";
+                    return 1;
                 }
             }
         }
+    }
 
-        /// \brief Draw the grid
-        void draw(sf::RenderTarget& target, sf::RenderStates states = sf::RenderStates::Default)
-        {
-            sf::FloatRect viewRect(view.getCenter().x-view.getSize().x/2, view.getCenter().y-view.getSize().y/2, view.getSize().x, view.getSize().y);
+    std::cout << generations << " generations in " << logicTime.asSeconds() << "s";
+    if (logicTime.asSeconds() > 0.f)
+        std::cout << " (" << generations/logicTime.asSeconds() << " per second)";
+    std::cout << "\n";
+    if (validateEvery > 0)
+        std::cout << "Matched the cell engine every " << validateEvery << " generations\n";
 
-            for (auto& pos : mInteresting)
-            {
-                int x = pos.x;
-                int y = pos.y;
+    return 0;
+}
 
-                if (!viewRect.intersects(sf::FloatRect(x*TILE_SIZE, y*TILE_SIZE, (x+1)*TILE_SIZE, (y+1)*TILE_SIZE)))
-                    continue;
+void printSpeed(int generations, float seconds)
+{
+    std::cout << generations << " generations in " << seconds << "s";
+    if (seconds > 0.f)
+        std::cout << " (" << generations/seconds << " per second)";
+    std::cout << "\n";
+}
 
-                mRect.setPosition(x*TILE_SIZE, y*TILE_SIZE);
+/// \brief Print the memory held by a board, the trace buffers and the probes, as a table or on one line
+template <typename Board>
+void printMemory(const Board& grid, bool oneLine, const Probes* probes = 0)
+{
+    MemoryReport report;
+    grid.reportMemory(report);
+    Trace::reportMemory(report);
+    if (probes)
+        probes->reportMemory(report);
+    if (oneLine)
+    {
+        report.printLine(std::cout);
+        std::cout << std::endl;
+    }
+    else
+        report.print(std::cout);
+}
 
-                switch (getCell(x, y))
-                {
-                case NONE: // Air
-                    mRect.setFillColor(sf::Color::Black);
-                    break;
-                case WIRE: // Wire
-                    mRect.setFillColor(sf::Color::Yellow);
-                    break;
-                case HEAD: // Electron head
-                    mRect.setFillColor(sf::Color::Blue);
-                    break;
-                case TAIL: // Electron tail
-                    mRect.setFillColor(sf::Color::Red);
-                    break;
-                }
+/// \brief Print what the probes saw: a summary and the words decoded from buses on the standard
+/// output, and every head to logPath if it is given
+int reportProbes(const Probes& probes, const std::string& logPath)
+{
+    probes.printSummary(std::cout);
+    probes.writeDecoded(std::cout);
+    if (logPath.empty())
+        return 0;
 
-                target.draw(mRect, states);
+    std::ofstream file(logPath.c_str());
+    if (!file)
+    {
+        std::cout << "Failed to write " << logPath << std::endl;
+        return 1;
+    }
+    probes.writeEvents(file);
+
+    return 0;
+}
+
+/// \brief Run the cell engine without a window until a stop condition holds. A depth above one
+/// advances the grid in temporally blocked passes of that many generations, unless there are probes,
+/// stop conditions or a publisher, which need to see every generation. If numaReport is set, where
+/// each band of rows is kept is printed at the end.
+int runHeadless(Grid& grid, int depth, bool memReport, bool numaReport, Probes& probes, const std::string& probeLog,
+                RunUntil& until)
+{
+    grid.flip(); // Commit the loaded cells
+
+    std::string error;
+    if (!probes.validate(grid, error) || !until.validate(probes, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    sf::Clock clock;
+    if (probes.isEmpty() && !until.hasConditions() && !until.hasObserver() && depth > 1)
+    {
+        grid.advance(until.getLimit(), depth);
+        printSpeed(until.getLimit(), clock.getElapsedTime().asSeconds());
+    }
+    else
+    {
+        until.run(grid, probes);
+        printSpeed(until.getGeneration(), clock.getElapsedTime().asSeconds());
+        until.printResult(std::cout, probes);
+    }
+
+    if (memReport)
+        printMemory(grid, false, &probes);
+    if (numaReport)
+        grid.printNumaReport(std::cout);
+
+    return probes.isEmpty() ? 0 : reportProbes(probes, probeLog);
+}
+
+/// \brief Run the unbounded grid without a window
+int runHeadless(InfiniteGrid& grid, bool memReport, Probes& probes, const std::string& probeLog, RunUntil& until)
+{
+    grid.flip(); // Commit the loaded cells
+
+    std::string error;
+    if (!probes.validate(grid, error) || !until.validate(probes, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    PoolStats chunks = InfiniteGrid::getChunkStats();
+    PoolStats lists = InfiniteGrid::getCellListStats();
+
+    sf::Clock clock;
+    until.run(grid, probes);
+    printSpeed(until.getGeneration(), clock.getElapsedTime().asSeconds());
+    until.printResult(std::cout, probes);
+
+    // Slabs are the only allocations which reach the system allocator
+    std::size_t slabs = InfiniteGrid::getChunkStats().slabs - chunks.slabs + InfiniteGrid::getCellListStats().slabs - lists.slabs;
+    std::cout << grid.getChunkCount() << " chunks allocated, " << slabs << " new slabs during the run\n";
+
+    if (memReport)
+        printMemory(grid, false, &probes);
+
+    return probes.isEmpty() ? 0 : reportProbes(probes, probeLog);
+}
+
+/// \brief Run a board kept in a tile file without a window, then print how the tiles were paged
+int runHeadless(PagedGrid& grid, bool memReport, Probes& probes, const std::string& probeLog, RunUntil& until)
+{
+    grid.flip(); // Commit the loaded cells
+
+    std::string error;
+    if (!probes.validate(grid, error) || !until.validate(probes, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    sf::Clock clock;
+    until.run(grid, probes);
+    printSpeed(until.getGeneration(), clock.getElapsedTime().asSeconds());
+    until.printResult(std::cout, probes);
+    grid.printStats(std::cout);
+
+    if (memReport)
+        printMemory(grid, false, &probes);
+
+    return probes.isEmpty() ? 0 : reportProbes(probes, probeLog);
+}
+
+/// \brief Run the benchmark workloads through every engine. The JSON report goes to jsonPath, or to
+/// the standard output after the summary if no path is given.
+int runBenchmark(const std::string& filename, int generations, const std::string& jsonPath)
+{
+    Benchmark benchmark(generations);
+    benchmark.addStandardWorkloads(filename);
+    benchmark.run(std::cout);
+
+    if (jsonPath.empty())
+    {
+        benchmark.writeJson(std::cout);
+        return 0;
+    }
+
+    std::ofstream file(jsonPath.c_str());
+    if (!file)
+    {
+        std::cout << "Failed to write " << jsonPath << std::endl;
+        return 1;
+    }
+    benchmark.writeJson(file);
+
+    return 0;
+}
+
+/// \brief Run the blocked engine on the file tiled 4x4 with more and more threads, up to maxThreads
+int runScaling(const std::string& filename, int generations, int maxThreads)
+{
+    Benchmark benchmark(generations);
+    if (!benchmark.runScaling(filename, maxThreads, std::cout))
+    {
+        std::cout << "Failed to load " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/// \brief Count hardware events over a number of generations of each engine and print the counts
+/// per generation. Only update() is measured, except for the blocked engine where the counters
+/// cover the whole of advance(), its band threads included.
+int runPerf(const Grid& loaded, const std::string& filename, int generations)
+{
+    PerfCounters counters;
+    if (!counters.isAvailable())
+    {
+        std::cout << "Hardware counters are unavailable (Linux only, see /proc/sys/kernel/perf_event_paranoid)\n";
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(12) << "engine" << std::right;
+    for (int i = 0; i < PerfCounters::COUNTER_COUNT; i++)
+        std::cout << std::setw(15) << PerfCounters::getCounterName(static_cast<PerfCounters::Counter>(i));
+    std::cout << std::setw(8) << "IPC" << "   (per generation)\n";
+
+    const char* engines[] = {"reference", "lookup", "masked", "incremental", "blocked", "infinite"};
+    for (const std::string engine : engines)
+    {
+        unsigned long long totals[PerfCounters::COUNTER_COUNT] = {};
+        if (engine == "infinite")
+        {
+            InfiniteGrid grid;
+            grid.loadFromFile(filename);
+            grid.flip();
+            for (int generation = 0; generation < generations; generation++)
+            {
+                counters.start();
+                grid.update();
+                counters.stop(totals);
+                grid.flip();
             }
         }
-
-        /// \brief Set the next state to the current state
-        void flip()
+        else
         {
-            for (auto& pos : mInteresting)
+            Grid grid = loaded;
+            grid.flip(); // Commit the loaded cells
+            if (engine == "lookup")
+                grid.setEngine(Grid::LOOKUP);
+            else if (engine == "masked")
+                grid.setEngine(Grid::MASKED);
+            else if (engine == "incremental")
+                grid.setEngine(Grid::INCREMENTAL);
+            if (engine == "blocked")
             {
-                int x = pos.x;
-                int y = pos.y;
-
-                mCells[y*mWidth + x].current = mCells[y*mWidth + x].next;
+                counters.start();
+                grid.advance(generations);
+                counters.stop(totals);
+            }
+            else
+            {
+                for (int generation = 0; generation < generations; generation++)
+                {
+                    counters.start();
+                    grid.update();
+                    counters.stop(totals);
+                    grid.flip();
+                }
             }
         }
 
-        /// \brief Get the contents of a cell
-        CellState getCell(int x, int y) const
+        std::cout << std::left << std::setw(12) << engine << std::right;
+        for (int i = 0; i < PerfCounters::COUNTER_COUNT; i++)
         {
-            return mCells[y*mWidth + x].current;
+            if (counters.isAvailable(static_cast<PerfCounters::Counter>(i)))
+                std::cout << std::setw(15) << totals[i]/generations;
+            else
+                std::cout << std::setw(15) << "n/a";
         }
+        if (totals[PerfCounters::CYCLES] > 0)
+            std::cout << std::setw(8) << std::fixed << std::setprecision(2)
+                      << static_cast<double>(totals[PerfCounters::INSTRUCTIONS])/totals[PerfCounters::CYCLES];
+        std::cout << "\n";
+    }
 
-        /// \brief Set the contents of a cell.
-        void setCell(int x, int y, CellState cell)
-        {
-            if (x < 0 || y < 0 || x >= mWidth || y >= mHeight)
-                return;
+    return 0;
+}
+
+/// \brief Run every variant listed in variantsPath from the loaded grid and print their results
+int runSweep(Grid& grid, const std::string& variantsPath, int generations, int threads, Sweep::Engine engine)
+{
+    grid.flip(); // Commit the loaded cells
+
+    Sweep sweep(grid);
+    sweep.setEngine(engine);
+    std::string error;
+    if (!sweep.loadVariants(variantsPath, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    sf::Clock clock;
+    sweep.run(generations, threads);
+    float seconds = clock.getElapsedTime().asSeconds();
+
+    sweep.printResults(std::cout);
+    std::cout << sweep.getVariantCount() << " variants on " << threads << " threads: ";
+    printSpeed(generations*sweep.getVariantCount(), seconds);
+
+    return 0;
+}
+
+/// \brief Run the board in filename as horizontal slabs, one worker process each, and print their results
+int runSlabs(const std::string& filename, int slabs, int generations, Grid::Engine engine)
+{
+    SlabRunner runner(filename, slabs);
+    runner.setEngine(engine);
+    std::string error;
+    if (!runner.run(generations, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    runner.printResults(std::cout);
+    printSpeed(generations, runner.getSeconds());
+
+    return 0;
+}
+
+/// \brief Run this process's rectangle of a board split over columns x rows nodes, exchanging halos
+/// with the neighbours over TCP, and print its results and the board's
+int runNode(const std::string& filename, int columns, int rows, int rank, int halo, const std::string& hostsPath,
+            unsigned short basePort, int generations)
+{
+    HaloNode node(columns, rows, rank, halo);
+    std::string error;
+    if ((!hostsPath.empty() && !node.loadHosts(hostsPath, error)) || !node.start(filename, basePort, error) ||
+        !node.run(generations, error))
+    {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    node.printResults(std::cout);
+    printSpeed(generations, node.getSeconds());
+
+    return 0;
+}
 
-            if (mCells[y*mWidth + x].next == 0 && cell != 0)
-                mInteresting.push_back(sf::Vector2i(x, y));
-            mCells[y*mWidth + x].next = cell;
+/// \brief Grid cell under the mouse, rounding down so cells left of and above the origin work too
+sf::Vector2i mouseCell(const sf::RenderWindow& window)
+{
+    sf::Vector2f coords = window.mapPixelToCoords(sf::Mouse::getPosition(window), view);
+    return sf::Vector2i(std::floor(coords.x/TILE_SIZE), std::floor(coords.y/TILE_SIZE));
+}
+
+/// \brief Move the camera with the arrow keys and zoom with Z and X
+void moveView(float dt)
+{
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up))
+        view.move(0, -1000.f*dt);
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down))
+        view.move(0, 1000.f*dt);
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left))
+        view.move(-1000.f*dt, 0);
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right))
+        view.move(1000.f*dt, 0);
+
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Z))
+        view.zoom(1.f+dt);
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::X))
+        view.zoom(1.f-dt);
+}
+
+/// \brief Watch a board streamed by --publish from address, given as host:port or just the port of a
+/// publisher on this machine. Frames are drawn as they arrive, with the same colours as the simulator.
+int runViewer(const std::string& address)
+{
+    std::size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    int port = std::atoi(address.substr(colon == std::string::npos ? 0 : colon + 1).c_str());
+
+    sf::TcpSocket socket;
+    if (port <= 0 || socket.connect(sf::IpAddress(host), port) != sf::Socket::Done)
+    {
+        std::cout << "Failed to connect to " << address << std::endl;
+        return 1;
+    }
+    socket.setBlocking(false);
+
+    sf::RenderWindow window;
+    window.create(sf::VideoMode(800, 608), "Wireworld Viewer");
+
+    Grid grid;
+    std::vector<unsigned char> cells;
+    std::vector<int> changed;
+    sf::Clock clock;
+    bool connected = true;
+    while (window.isOpen())
+    {
+        float dt = clock.restart().asSeconds();
+
+        sf::Event event;
+        while (window.pollEvent(event))
+        {
+            if (event.type == sf::Event::Closed)
+                window.close();
         }
 
-        /// \brief Compute the wrapped x coordinate
-        int wrapX(int x) const
+        // Apply every frame which has arrived
+        sf::Packet packet;
+        sf::Socket::Status status = sf::Socket::NotReady;
+        while (connected && (status = socket.receive(packet)) == sf::Socket::Done)
         {
-            if (x < 0)
+            sf::Uint8 frame = 0;
+            sf::Uint32 generation = 0;
+            sf::Uint32 width = 0;
+            sf::Uint32 height = 0;
+            std::string changes;
+            packet >> frame >> generation >> width >> height >> changes;
+
+            if (frame == Publisher::KEYFRAME)
             {
-                x = x % mWidth;
-                if (x < 0)
-                    x += mWidth;
+                grid = Grid(width, height);
+                cells.assign(width*height, NONE);
             }
-            else if (x >= mWidth)
-                x = x % mWidth;
-
-            return x;
-        }
 
-        /// \brief Compute the wrapped y coordinate.
-        int wrapY(int y) const
-        {
-            if (y < 0)
+            changed.clear();
+            if (!packet || cells.size() != width*height || !Publisher::decode(changes, cells, changed))
             {
-                y = y % mHeight;
-                if (y < 0)
-                    y += mHeight;
+                std::cout << "Bad frame from " << address << std::endl;
+                return 1;
             }
-            else if (y >= mHeight)
-                y = y % mHeight;
+            for (int cell : changed)
+                grid.setCell(cell % width, cell / width, static_cast<CellState>(cells[cell]));
+            grid.flip();
 
-            return y;
+            std::ostringstream title;
+            title << "Wireworld Viewer - generation " << generation;
+            window.setTitle(title.str());
         }
-
-    private:
-        struct Cell
+        if (connected && status != sf::Socket::NotReady && status != sf::Socket::Done)
         {
-            CellState current;
-            CellState next;
-        };
-
-        int mWidth;
-        int mHeight;
-        std::vector<Cell> mCells;
-        sf::RectangleShape mRect;
-
-        std::vector<sf::Vector2i> mInteresting;
-};
+            std::cout << "The publisher went away" << std::endl;
+            connected = false;
+        }
 
-int main()
-{
-    std::cout << "Wireworld Simulator\n";
-    std::cout << "Theodore DeRego\n";
-    std::cout << "CS 321 @ UH Hilo\n";
-    std::cout << "Spring 2014\n\n";
+        moveView(dt);
 
-    sf::RenderWindow window;
-    window.create(sf::VideoMode(800, 608), "Wireworld Simulator");
+        window.setView(view);
+        window.clear(sf::Color::Black);
+        grid.draw(window);
+        window.display();
+    }
 
-    std::ifstream file("primes.wi");
-    int width = 0;
-    int height = 0;
+    return 0;
+}
 
-    // First load grid dims and create grid
-    file >> width >> height;
-    Grid grid(width, height);
+/// \brief Answer control requests without a window until a client asks for SHUTDOWN
+template <typename Board>
+int runServer(Board& grid, ControlServer& server, Probes& probes)
+{
+    grid.flip(); // Commit the loaded cells
 
-    // Now load the data
-    for (int y = 0; y < height; y++)
+    while (server.wait(grid, probes))
     {
-        for (int x = 0; x < width; x++)
-        {
-            char c = file.get();
-            if (c == ' ')
-                grid.setCell(x, y, NONE);
-            else if (c == '#')
-                grid.setCell(x, y, WIRE);
-            else if (c == '@')
-                grid.setCell(x, y, HEAD);
-            else if (c == '~')
-                grid.setCell(x, y, TAIL);
-        }
-        file.get(); // skip the new line
     }
-    file.close();
+
+    return 0;
+}
+
+/// \brief Run the interactive simulation. The font is only used to label the timing overlay. With
+/// memReport, memory use is printed along with the timings every second. Requests to the control
+/// server, if there is one, are answered once a frame, and the board is offered to the publisher,
+/// if there is one, after each generation.
+template <typename Board>
+int runWindow(Board& grid, const sf::Font* font, bool memReport, ControlServer* server, Probes& probes,
+              Publisher* publisher)
+{
+    sf::RenderWindow window;
+    window.create(sf::VideoMode(800, 608), "Wireworld Simulator");
 
     sf::Clock clock;
     float dtAccum = 0.f;
     int frames = 0;
     bool paused = false;
+    long long generation = 0;
     bool render = true;
+    bool overlay = false;
+    FrameProfiler profiler;
     while (window.isOpen())
     {
         // Get delta time
@@ -238,7 +548,11 @@ int main()
 
         if (dtAccum >= 1.f)
         {
-            std::cout << frames << std::endl;
+            std::cout << frames << " fps | ";
+            profiler.printSummary(std::cout);
+            std::cout << std::endl;
+            if (memReport)
+                printMemory(grid, true);
             dtAccum = 0.f;
             frames = 0;
         }
@@ -259,56 +573,52 @@ int main()
                     else
                         paused = !paused;
                 }
+                else if (event.key.code == sf::Keyboard::F3)
+                    overlay = !overlay;
             }
         }
+        profiler.lap(FrameProfiler::EVENTS);
 
         if (!paused)
+        {
             grid.update();
+            generation++;
+        }
+        profiler.lap(FrameProfiler::UPDATE);
 
         // Left mouse to place an electron head
         if (sf::Mouse::isButtonPressed(sf::Mouse::Left))
         {
-            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-
-            int gridX = mousePos.x/TILE_SIZE;
-            int gridY = mousePos.y/TILE_SIZE;
+            sf::Vector2i cell = mouseCell(window);
 
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::LShift))
-                grid.setCell(gridX, gridY, TAIL);
+                grid.setCell(cell.x, cell.y, TAIL);
             else
-                grid.setCell(gridX, gridY, HEAD);
+                grid.setCell(cell.x, cell.y, HEAD);
         }
 
         // Right mouse to place a wire
         if (sf::Mouse::isButtonPressed(sf::Mouse::Right))
         {
-            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-
-            int gridX = mousePos.x/TILE_SIZE;
-            int gridY = mousePos.y/TILE_SIZE;
+            sf::Vector2i cell = mouseCell(window);
 
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::LShift))
-                grid.setCell(gridX, gridY, NONE);
+                grid.setCell(cell.x, cell.y, NONE);
             else
-                grid.setCell(gridX, gridY, WIRE);
+                grid.setCell(cell.x, cell.y, WIRE);
         }
 
-        // Move the camera
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up))
-            view.move(0, -1000.f*dt);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down))
-            view.move(0, 1000.f*dt);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left))
-            view.move(-1000.f*dt, 0);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right))
-            view.move(1000.f*dt, 0);
-
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Z))
-            view.zoom(1.f+dt);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::X))
-            view.zoom(1.f-dt);
+        moveView(dt);
+        profiler.lap(FrameProfiler::EDIT);
 
         grid.flip();
+        profiler.lap(FrameProfiler::FLIP);
+
+        if (server && !server->poll(grid, probes))
+            window.close();
+        if (publisher)
+            publisher->offer(grid, generation);
+        profiler.lap(FrameProfiler::IO);
 
         // clear the window with black color
         window.setView(view);
@@ -316,10 +626,313 @@ int main()
 
         if (render)
             grid.draw(window);
+        if (overlay)
+            profiler.draw(window, font);
+        profiler.lap(FrameProfiler::DRAW);
 
         // end the current frame
         window.display();
+        profiler.lap(FrameProfiler::DISPLAY);
     }
 
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+    std::cout << "Wireworld Simulator\n";
+    std::cout << "Theodore DeRego\n";
+    std::cout << "CS 321 @ UH Hilo\n";
+    std::cout << "Spring 2014\n\n";
+
+    std::string filename = "primes.wi";
+    int headlessGenerations = 0;
+    int blockDepth = 1;
+    Grid::Engine engine = Grid::REFERENCE;
+    Grid::Layout layout = Grid::ROWS;
+    int logicGenerations = 0;
+    int validateEvery = 0;
+    bool infinite = false;
+    int pagedMegabytes = 0;
+    std::string pageFile = "wireworld.pages";
+    int benchmarkGenerations = 0;
+    int scalingGenerations = 0;
+    std::string jsonPath;
+    std::string fontPath;
+    int perfGenerations = 0;
+    std::string tracePath;
+    bool memReport = false;
+    bool numaReport = false;
+    std::string sweepPath;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int gridThreads = 1; // Unless --threads is given
+    int slabs = 0;
+    int nodeColumns = 0;
+    int nodeRows = 0;
+    int rank = 0;
+    int halo = 1;
+    std::string hostsPath;
+    int nodePort = 7300;
+    Sweep::Engine sweepEngine = Sweep::SCALAR;
+    Probes probes;
+    std::string probeLog;
+    std::vector<std::string> stopConditions;
+    int servePort = 0;
+    bool noWindow = false;
+    int publishPort = 0;
+    float publishFps = 30.f;
+    std::string viewAddress;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless" && i+1 < argc)
+            headlessGenerations = std::atoi(argv[++i]);
+        else if (arg == "--block" && i+1 < argc)
+            blockDepth = std::atoi(argv[++i]);
+        else if (arg == "--engine" && i+1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "lookup")
+                engine = Grid::LOOKUP;
+            else if (name == "masked")
+                engine = Grid::MASKED;
+            else if (name == "incremental")
+                engine = Grid::INCREMENTAL;
+            else if (name == "reference")
+                engine = Grid::REFERENCE;
+            else
+            {
+                std::cout << "Unknown engine " << name << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--layout" && i+1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "tiles")
+                layout = Grid::TILES;
+            else if (name == "rows")
+                layout = Grid::ROWS;
+            else
+            {
+                std::cout << "Unknown layout " << name << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--logic" && i+1 < argc)
+            logicGenerations = std::atoi(argv[++i]);
+        else if (arg == "--validate" && i+1 < argc)
+            validateEvery = std::atoi(argv[++i]);
+        else if (arg == "--infinite")
+            infinite = true;
+        else if (arg == "--paged" && i+1 < argc)
+            pagedMegabytes = std::atoi(argv[++i]);
+        else if (arg == "--page-file" && i+1 < argc)
+            pageFile = argv[++i];
+        else if (arg == "--benchmark" && i+1 < argc)
+            benchmarkGenerations = std::atoi(argv[++i]);
+        else if (arg == "--scaling" && i+1 < argc)
+            scalingGenerations = std::atoi(argv[++i]);
+        else if (arg == "--json" && i+1 < argc)
+            jsonPath = argv[++i];
+        else if (arg == "--font" && i+1 < argc)
+            fontPath = argv[++i];
+        else if (arg == "--perf" && i+1 < argc)
+            perfGenerations = std::atoi(argv[++i]);
+        else if (arg == "--trace" && i+1 < argc)
+            tracePath = argv[++i];
+        else if (arg == "--mem-report")
+            memReport = true;
+        else if (arg == "--numa-report")
+            numaReport = true;
+        else if (arg == "--sweep" && i+1 < argc)
+            sweepPath = argv[++i];
+        else if (arg == "--threads" && i+1 < argc)
+            threads = gridThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--slabs" && i+1 < argc)
+            slabs = std::atoi(argv[++i]);
+        else if (arg == "--nodes" && i+1 < argc)
+        {
+            std::string shape = argv[++i];
+            std::size_t x = shape.find('x');
+            nodeColumns = std::atoi(shape.c_str());
+            nodeRows = x == std::string::npos ? 1 : std::atoi(shape.c_str() + x + 1);
+            if (nodeColumns <= 0 || nodeRows <= 0)
+            {
+                std::cout << "Expected --nodes columns or columnsxrows, not " << shape << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--rank" && i+1 < argc)
+            rank = std::atoi(argv[++i]);
+        else if (arg == "--halo" && i+1 < argc)
+            halo = std::atoi(argv[++i]);
+        else if (arg == "--hosts" && i+1 < argc)
+            hostsPath = argv[++i];
+        else if (arg == "--node-port" && i+1 < argc)
+            nodePort = std::atoi(argv[++i]);
+        else if (arg == "--lanes")
+            sweepEngine = Sweep::LANES;
+        else if ((arg == "--probe" || arg == "--probes") && i+1 < argc)
+        {
+            std::string error;
+            bool loaded = arg == "--probe" ? probes.parse(argv[++i], error) : probes.loadFromFile(argv[++i], error);
+            if (!loaded)
+            {
+                std::cout << error << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--probe-log" && i+1 < argc)
+            probeLog = argv[++i];
+        else if (arg == "--until" && i+1 < argc)
+            stopConditions.push_back(argv[++i]);
+        else if (arg == "--serve" && i+1 < argc)
+            servePort = std::atoi(argv[++i]);
+        else if (arg == "--no-window")
+            noWindow = true;
+        else if (arg == "--publish" && i+1 < argc)
+            publishPort = std::atoi(argv[++i]);
+        else if (arg == "--publish-fps" && i+1 < argc)
+            publishFps = std::atof(argv[++i]);
+        else if (arg == "--view" && i+1 < argc)
+            viewAddress = argv[++i];
+        else
+            filename = arg;
+    }
+
+    TraceSession trace(tracePath);
+
+    RunUntil until(headlessGenerations);
+    for (const std::string& condition : stopConditions)
+    {
+        std::string error;
+        if (!until.parse(condition, error))
+        {
+            std::cout << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (benchmarkGenerations > 0)
+        return runBenchmark(filename, benchmarkGenerations, jsonPath);
+    if (scalingGenerations > 0)
+        return runScaling(filename, scalingGenerations, threads);
+    if (!viewAddress.empty())
+        return runViewer(viewAddress);
+    if (slabs > 0)
+    {
+        // The workers load their own slabs, so the board is never loaded here
+        if (headlessGenerations <= 0)
+        {
+            std::cout << "--slabs needs --headless to give the number of generations" << std::endl;
+            return 1;
+        }
+        return runSlabs(filename, slabs, headlessGenerations, engine);
+    }
+    if (nodeColumns > 0)
+    {
+        if (headlessGenerations <= 0)
+        {
+            std::cout << "--nodes needs --headless to give the number of generations" << std::endl;
+            return 1;
+        }
+        return runNode(filename, nodeColumns, nodeRows, rank, halo, hostsPath, nodePort, headlessGenerations);
+    }
+    if (pagedMegabytes > 0)
+    {
+        if (headlessGenerations <= 0)
+        {
+            std::cout << "--paged needs --headless to give the number of generations" << std::endl;
+            return 1;
+        }
+
+        PagedGrid grid(pageFile, static_cast<std::size_t>(pagedMegabytes)*1024*1024/PagedGrid::getTileBytes());
+        std::string error;
+        if (!grid.loadFromFile(filename, error))
+        {
+            std::cout << error << std::endl;
+            return 1;
+        }
+        return runHeadless(grid, memReport, probes, probeLog, until);
+    }
+
+    sf::Font font;
+    if (!fontPath.empty() && !font.loadFromFile(fontPath))
+    {
+        std::cout << "Failed to load " << fontPath << std::endl;
+        return 1;
+    }
+    const sf::Font* overlayFont = fontPath.empty() ? 0 : &font;
+
+    ControlServer server;
+    if (servePort > 0 && !server.start(servePort))
+    {
+        std::cout << "Failed to listen on port " << servePort << std::endl;
+        return 1;
+    }
+    ControlServer* control = servePort > 0 ? &server : 0;
+
+    if (infinite)
+    {
+        InfiniteGrid grid;
+        if (!grid.loadFromFile(filename))
+        {
+            std::cout << "Failed to load " << filename << std::endl;
+            return 1;
+        }
+
+        if (publishPort > 0)
+        {
+            std::cout << "--publish needs a bounded grid" << std::endl;
+            return 1;
+        }
+
+        if (headlessGenerations > 0)
+            return runHeadless(grid, memReport, probes, probeLog, until);
+        if (control && noWindow)
+            return runServer(grid, server, probes);
+        return runWindow(grid, overlayFont, memReport, control, probes, 0);
+    }
+
+    Grid grid;
+    grid.setLayout(layout);
+    grid.setThreads(gridThreads); // Before loading, so each band's thread touches its cells first
+    if (!grid.loadFromFile(filename))
+    {
+        std::cout << "Failed to load " << filename << std::endl;
+        return 1;
+    }
+    grid.setEngine(engine);
+
+    Publisher publisher;
+    if (publishPort > 0)
+    {
+        if (!publisher.start(publishPort, grid.getWidth(), grid.getHeight(), publishFps))
+        {
+            std::cout << "Failed to listen on port " << publishPort << std::endl;
+            return 1;
+        }
+        until.setObserver([&](long long generation) {publisher.offer(grid, generation);});
+    }
+
+    if (!sweepPath.empty())
+    {
+        if (headlessGenerations <= 0)
+        {
+            std::cout << "--sweep needs --headless to give the number of generations" << std::endl;
+            return 1;
+        }
+        return runSweep(grid, sweepPath, headlessGenerations, threads, sweepEngine);
+    }
+    if (perfGenerations > 0)
+        return runPerf(grid, filename, perfGenerations);
+    if (logicGenerations > 0)
+        return runLogic(grid, logicGenerations, validateEvery);
+    if (headlessGenerations > 0)
+        return runHeadless(grid, blockDepth, memReport, numaReport, probes, probeLog, until);
+    if (control && noWindow)
+        return runServer(grid, server, probes);
+
+    return runWindow(grid, overlayFont, memReport, control, probes, publishPort > 0 ? &publisher : 0);
+}
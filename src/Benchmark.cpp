@@ -0,0 +1,506 @@
+#include "Benchmark.hpp"
+
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <SFML/System.hpp>
+
+#include "InfiniteGrid.hpp"
+#include "LogicCircuit.hpp"
+#include "NumaTopology.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    // The tiled engines are the reference and lookup kernels on the TILES layout
+    const char* const Engines[] = {"reference", "lookup", "masked", "incremental", "tiled", "tiled lookup", "blocked", "infinite", "logic"};
+    // The ones which step a Grid with update()
+    const char* const GridEngines[] = {"reference", "lookup", "masked", "incremental", "tiled", "tiled lookup"};
+    const int BlockDepth = 4; // For the blocked engine
+    const int EditGenerations = 16; // Stepped by checkEdits()
+    const int Margin = 2; // Empty border around synthetic workloads, so wrapping never matters
+
+    /// \brief Small LCG so the synthetic workloads are the same on every platform
+    class Random
+    {
+        public:
+            explicit Random(unsigned long long seed) : mState(seed) {}
+
+            unsigned next(unsigned bound)
+            {
+                mState = mState*6364136223846793005ull + 1442695040888963407ull;
+                return static_cast<unsigned>(mState >> 33) % bound;
+            }
+
+        private:
+            unsigned long long mState;
+    };
+
+    /// \brief Set the engine and layout of a grid for one of the engines which run on Grid
+    void configure(Grid& grid, const std::string& engine)
+    {
+        if (engine == "lookup" || engine == "tiled lookup")
+            grid.setEngine(Grid::LOOKUP);
+        else if (engine == "masked")
+            grid.setEngine(Grid::MASKED);
+        else if (engine == "incremental")
+            grid.setEngine(Grid::INCREMENTAL);
+        grid.setLayout(engine == "tiled" || engine == "tiled lookup" ? Grid::TILES : Grid::ROWS);
+    }
+
+    std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+}
+
+Benchmark::Benchmark(int generations) : mGenerations(generations)
+{
+}
+
+void Benchmark::addStandardWorkloads(const std::string& filename)
+{
+    addFile(filename, filename, 1, 1);
+    addFile(filename + " 3x3", filename, 3, 3);
+    addFile(filename + " 8x1", filename, 8, 1);
+    addMesh("dense mesh 512", 512, 3);
+    addRandomLoops("sparse loops 2048", 2048, 4000);
+}
+
+void Benchmark::run(std::ostream& log)
+{
+    mResults.clear();
+    for (const Workload& workload : mWorkloads)
+    {
+        checkEdits(workload, log);
+        for (const char* engine : Engines)
+        {
+            TraceScope trace("run", "benchmark");
+            Result result = runIsolated(workload, engine);
+            mResults.push_back(result);
+
+            log << std::left << std::setw(24) << workload.name << " " << std::setw(12) << engine << std::right;
+            if (result.failed)
+            {
+                log << "  failed\n";
+                continue;
+            }
+            if (result.seconds > 0.0)
+                log << " " << std::setw(10) << static_cast<long long>(mGenerations/result.seconds) << " generations/s";
+            log << "  checksum " << std::hex << result.checksum << std::dec << "\n";
+        }
+    }
+}
+
+void Benchmark::writeJson(std::ostream& out) const
+{
+    TraceScope trace("report", "io");
+
+    out << "{\n  \"generations\": " << mGenerations << ",\n  \"runs\": [";
+    for (std::size_t i = 0; i < mResults.size(); i++)
+    {
+        const Result& result = mResults[i];
+        double cells = static_cast<double>(result.width)*result.height*mGenerations;
+        double generationsPerSecond = result.seconds > 0.0 ? mGenerations/result.seconds : 0.0;
+        double cellsPerSecond = result.seconds > 0.0 ? cells/result.seconds : 0.0;
+        double nsPerCell = cells > 0.0 ? result.seconds*1e9/cells : 0.0;
+
+        std::ostringstream checksum;
+        checksum << std::hex << std::setw(16) << std::setfill('0') << result.checksum;
+
+        out << (i > 0 ? "," : "") << "\n    {";
+        out << "\"workload\": \"" << escape(result.workload) << "\", ";
+        out << "\"engine\": \"" << result.engine << "\", ";
+        out << "\"width\": " << result.width << ", ";
+        out << "\"height\": " << result.height << ", ";
+        out << "\"conductors\": " << result.conductors << ", ";
+        out << "\"setup_seconds\": " << result.setupSeconds << ", ";
+        out << "\"seconds\": " << result.seconds << ", ";
+        out << "\"generations_per_second\": " << generationsPerSecond << ", ";
+        out << "\"cells_per_second\": " << cellsPerSecond << ", ";
+        out << "\"ns_per_cell\": " << nsPerCell << ", ";
+        out << "\"peak_rss_bytes\": " << result.peakRss << ", ";
+        out << "\"failed\": " << (result.failed ? "true" : "false") << ", ";
+        out << "\"checksum\": \"" << checksum.str() << "\"}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+bool Benchmark::runScaling(const std::string& filename, int maxThreads, std::ostream& log)
+{
+    mWorkloads.clear();
+    addFile(filename + " 4x4", filename, 4, 4);
+    if (mWorkloads.empty())
+        return false;
+    const Workload& workload = mWorkloads.back();
+
+    const NumaTopology& machine = NumaTopology::getMachine();
+    log << "blocked engine on " << workload.name << " (" << workload.width << "x" << workload.height << "), "
+        << machine.getNodeCount() << (machine.getNodeCount() == 1 ? " NUMA node, " : " NUMA nodes, ")
+        << machine.getCpuCount() << " CPUs\n";
+    log << "threads  nodes  cells touched by  generations/s  speed-up\n";
+
+    std::vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(std::max(1, maxThreads));
+
+    double baseline = 0.0;
+    for (int threads : counts)
+    {
+        std::set<int> nodes;
+        for (int worker = 0; worker < threads; worker++)
+            nodes.insert(machine.getNode(machine.getCpu(worker, threads)));
+
+        // One thread touches every cell either way
+        for (int firstTouch = 1; firstTouch >= (threads > 1 ? 0 : 1); firstTouch--)
+        {
+            TraceScope trace("scaling", "benchmark");
+            Result result = runWorkload(workload, "blocked", threads, firstTouch != 0);
+            double speed = result.seconds > 0.0 ? mGenerations/result.seconds : 0.0;
+            if (threads == 1)
+                baseline = speed;
+
+            std::ostringstream speedUp;
+            speedUp << std::fixed << std::setprecision(2) << (baseline > 0.0 ? speed/baseline : 0.0);
+            log << std::setw(7) << threads << "  " << std::setw(5) << nodes.size() << "  " << std::left
+                << std::setw(16) << (threads == 1 ? "the thread" : firstTouch ? "each band's" : "one thread")
+                << std::right << "  " << std::setw(13) << static_cast<long long>(speed) << "  "
+                << std::setw(8) << speedUp.str() << "  checksum " << std::hex << result.checksum << std::dec << "\n";
+        }
+    }
+    return true;
+}
+
+void Benchmark::addFile(const std::string& name, const std::string& filename, int columns, int rows)
+{
+    Grid grid;
+    if (!grid.loadFromFile(filename))
+        return;
+    grid.flip();
+
+    Workload workload;
+    workload.name = name;
+    workload.width = grid.getWidth()*columns;
+    workload.height = grid.getHeight()*rows;
+    workload.cells.resize(workload.width*workload.height);
+    for (int y = 0; y < workload.height; y++)
+    {
+        for (int x = 0; x < workload.width; x++)
+            workload.cells[y*workload.width + x] = grid.getCell(x % grid.getWidth(), y % grid.getHeight());
+    }
+    mWorkloads.push_back(workload);
+}
+
+void Benchmark::addMesh(const std::string& name, int size, int spacing)
+{
+    Workload workload;
+    workload.name = name;
+    workload.width = size;
+    workload.height = size;
+    workload.cells.assign(size*size, NONE);
+
+    // Lattice of crossing wires with a few electrons dropped on it
+    Random random(1);
+    for (int y = Margin; y < size - Margin; y++)
+    {
+        for (int x = Margin; x < size - Margin; x++)
+        {
+            if (x % spacing == 0 || y % spacing == 0)
+                workload.cells[y*size + x] = random.next(64) == 0 ? HEAD : WIRE;
+        }
+    }
+    mWorkloads.push_back(workload);
+}
+
+void Benchmark::addRandomLoops(const std::string& name, int size, int loops)
+{
+    Workload workload;
+    workload.name = name;
+    workload.width = size;
+    workload.height = size;
+    workload.cells.assign(size*size, NONE);
+
+    // Rectangular loops carrying one electron each, which may overlap into stranger circuits
+    Random random(2);
+    for (int i = 0; i < loops; i++)
+    {
+        int w = 4 + random.next(12);
+        int h = 3 + random.next(8);
+        int left = Margin + random.next(size - 2*Margin - w);
+        int top = Margin + random.next(size - 2*Margin - h);
+        for (int x = left; x < left + w; x++)
+        {
+            workload.cells[top*size + x] = WIRE;
+            workload.cells[(top + h - 1)*size + x] = WIRE;
+        }
+        for (int y = top; y < top + h; y++)
+        {
+            workload.cells[y*size + left] = WIRE;
+            workload.cells[y*size + left + w - 1] = WIRE;
+        }
+        workload.cells[top*size + left + 1] = HEAD;
+        workload.cells[top*size + left] = TAIL;
+    }
+    mWorkloads.push_back(workload);
+}
+
+Benchmark::Result Benchmark::runWorkload(const Workload& workload, const std::string& engine, int threads,
+                                         bool firstTouch) const
+{
+    Result result;
+    result.workload = workload.name;
+    result.engine = engine;
+    result.width = workload.width;
+    result.height = workload.height;
+    result.conductors = 0;
+    for (CellState cell : workload.cells)
+        result.conductors += cell != NONE;
+
+    std::vector<CellState> cells(workload.cells.size());
+    sf::Clock clock;
+    if (engine == "infinite")
+    {
+        InfiniteGrid grid;
+        for (int y = 0; y < workload.height; y++)
+        {
+            for (int x = 0; x < workload.width; x++)
+            {
+                if (workload.cells[y*workload.width + x] != NONE)
+                    grid.setCell(x, y, workload.cells[y*workload.width + x]);
+            }
+        }
+        grid.flip();
+        result.setupSeconds = clock.restart().asSeconds();
+
+        for (int generation = 0; generation < mGenerations; generation++)
+        {
+            grid.update();
+            grid.flip();
+        }
+        result.seconds = clock.getElapsedTime().asSeconds();
+
+        for (int y = 0; y < workload.height; y++)
+        {
+            for (int x = 0; x < workload.width; x++)
+                cells[y*workload.width + x] = grid.getCell(x, y);
+        }
+    }
+    else
+    {
+        Grid grid(workload.width, workload.height);
+        grid.setThreads(threads, firstTouch);
+        configure(grid, engine);
+        for (int y = 0; y < workload.height; y++)
+        {
+            for (int x = 0; x < workload.width; x++)
+            {
+                if (workload.cells[y*workload.width + x] != NONE)
+                    grid.setCell(x, y, workload.cells[y*workload.width + x]);
+            }
+        }
+        grid.flip();
+
+        if (engine == "logic")
+        {
+            // Boards too small to extract are left unstepped, with no speed
+            LogicCircuit circuit;
+            std::string error;
+            bool extracted = circuit.extract(grid, error);
+            result.setupSeconds = clock.restart().asSeconds();
+
+            if (extracted)
+            {
+                for (int generation = 0; generation < mGenerations; generation++)
+                    circuit.step();
+                result.seconds = clock.getElapsedTime().asSeconds();
+                circuit.materialize(cells);
+            }
+            else
+            {
+                result.seconds = 0.0;
+                for (int y = 0; y < workload.height; y++)
+                {
+                    for (int x = 0; x < workload.width; x++)
+                        cells[y*workload.width + x] = grid.getCell(x, y);
+                }
+            }
+        }
+        else
+        {
+            result.setupSeconds = clock.restart().asSeconds();
+
+            if (engine == "blocked")
+                grid.advance(mGenerations, BlockDepth);
+            else
+            {
+                for (int generation = 0; generation < mGenerations; generation++)
+                {
+                    grid.update();
+                    grid.flip();
+                }
+            }
+            result.seconds = clock.getElapsedTime().asSeconds();
+
+            for (int y = 0; y < workload.height; y++)
+            {
+                for (int x = 0; x < workload.width; x++)
+                    cells[y*workload.width + x] = grid.getCell(x, y);
+            }
+        }
+    }
+
+    result.peakRss = 0;
+    result.checksum = checksum(cells);
+    result.failed = false;
+    return result;
+}
+
+Benchmark::Result Benchmark::runIsolated(const Workload& workload, const std::string& engine) const
+{
+#if defined(_WIN32)
+    return runWorkload(workload, engine);
+#else
+    // What the parent doesn't already know comes back through a pipe
+    struct Measured
+    {
+        double setupSeconds;
+        double seconds;
+        unsigned long long checksum;
+    };
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return runWorkload(workload, engine);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        Result result = runWorkload(workload, engine);
+        Measured measured = {result.setupSeconds, result.seconds, result.checksum};
+        bool written = write(fds[1], &measured, sizeof(measured)) == static_cast<ssize_t>(sizeof(measured));
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return runWorkload(workload, engine);
+    }
+
+    Measured measured = {0.0, 0.0, 0};
+    bool received = read(fds[0], &measured, sizeof(measured)) == static_cast<ssize_t>(sizeof(measured));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    bool waited = wait4(pid, &status, 0, &usage) == pid;
+
+    Result result;
+    result.workload = workload.name;
+    result.engine = engine;
+    result.width = workload.width;
+    result.height = workload.height;
+    result.conductors = 0;
+    for (CellState cell : workload.cells)
+        result.conductors += cell != NONE;
+    result.setupSeconds = measured.setupSeconds;
+    result.seconds = measured.seconds;
+    result.checksum = measured.checksum;
+    result.peakRss = 0;
+#if defined(__APPLE__)
+    if (waited)
+        result.peakRss = usage.ru_maxrss; // Already in bytes
+#else
+    if (waited)
+        result.peakRss = static_cast<std::size_t>(usage.ru_maxrss)*1024;
+#endif
+
+    // A run which crashed is reported as such rather than tried again here, where it would take
+    // the whole benchmark down
+    result.failed = !received || !waited || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    if (result.failed)
+    {
+        result.setupSeconds = 0.0;
+        result.seconds = 0.0;
+        result.checksum = 0;
+    }
+    return result;
+#endif
+}
+
+bool Benchmark::checkEdits(const Workload& workload, std::ostream& log) const
+{
+    TraceScope trace("check", "benchmark");
+
+    std::size_t edited = 0;
+    while (edited < workload.cells.size() && workload.cells[edited] == NONE)
+        edited++;
+
+    bool agree = true;
+    unsigned long long reference = 0;
+    for (const char* engine : GridEngines)
+    {
+        // The loaded cells are still pending at the first update(), and a cell is set between a
+        // flip() and an update() half way through
+        Grid grid(workload.width, workload.height);
+        configure(grid, engine);
+        for (int y = 0; y < workload.height; y++)
+        {
+            for (int x = 0; x < workload.width; x++)
+            {
+                if (workload.cells[y*workload.width + x] != NONE)
+                    grid.setCell(x, y, workload.cells[y*workload.width + x]);
+            }
+        }
+        for (int generation = 0; generation < EditGenerations; generation++)
+        {
+            if (generation == EditGenerations/2 && edited < workload.cells.size())
+                grid.setCell(edited % workload.width, edited / workload.width, HEAD);
+            grid.update();
+            grid.flip();
+        }
+
+        std::vector<CellState> cells(workload.cells.size());
+        for (int y = 0; y < workload.height; y++)
+        {
+            for (int x = 0; x < workload.width; x++)
+                cells[y*workload.width + x] = grid.getCell(x, y);
+        }
+        unsigned long long hash = checksum(cells);
+        if (engine == std::string(GridEngines[0]))
+            reference = hash;
+        else if (hash != reference)
+        {
+            log << workload.name << ": " << engine << " differs from " << GridEngines[0]
+                << " with cells set before update()\n";
+            agree = false;
+        }
+    }
+    return agree;
+}
+
+unsigned long long Benchmark::checksum(const std::vector<CellState>& cells)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (CellState cell : cells)
+    {
+        hash ^= static_cast<unsigned char>(cell);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
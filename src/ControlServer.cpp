@@ -0,0 +1,160 @@
+#include "ControlServer.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "InfiniteGrid.hpp"
+#include "QueuedSocket.hpp"
+
+ControlServer::ControlServer() : mHasRequest(false), mHasReply(false), mRunning(false), mShutdown(false), mGeneration(0)
+{
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+}
+
+bool ControlServer::start(unsigned short port)
+{
+    if (mListener.listen(port) != sf::Socket::Done)
+        return false;
+
+    mRunning = true;
+    mThread = std::thread(&ControlServer::serve, this);
+    return true;
+}
+
+void ControlServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mRunning)
+            return;
+        mRunning = false;
+        mChanged.notify_all();
+    }
+    mThread.join();
+    mListener.close();
+}
+
+void ControlServer::serve()
+{
+    // Clients never block: a request arrives a piece at a time and a reply goes out as the client
+    // takes it, so a client which stalls part way through either holds up nobody else. The next
+    // request from a client isn't read until the reply to the last has gone.
+    sf::SocketSelector selector;
+    selector.add(mListener);
+    std::vector<std::unique_ptr<QueuedSocket>> clients;
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!mRunning)
+                break;
+        }
+
+        bool sending = false;
+        for (const std::unique_ptr<QueuedSocket>& client : clients)
+            sending = sending || client->isSending();
+
+        // Wake up now and then to notice stop(), and often while replies are going out
+        bool ready = selector.wait(sf::milliseconds(sending ? 1 : 100));
+        if (!ready && !sending)
+            continue;
+
+        if (ready && selector.isReady(mListener))
+        {
+            std::unique_ptr<QueuedSocket> client(new QueuedSocket);
+            if (mListener.accept(*client) == sf::Socket::Done)
+            {
+                if (client->getRemoteAddress() == sf::IpAddress::LocalHost)
+                {
+                    selector.add(*client);
+                    clients.push_back(std::move(client));
+                }
+                else
+                    client->disconnect();
+            }
+        }
+
+        for (std::size_t i = 0; i < clients.size();)
+        {
+            // A client with a reply going out is out of the selector, so its next request doesn't
+            // wake the loop until the reply has gone
+            QueuedSocket& client = *clients[i];
+            bool alive = true;
+            if (client.isSending())
+            {
+                alive = client.flush();
+                if (alive && !client.isSending())
+                    selector.add(client);
+            }
+            else if (ready && selector.isReady(client))
+            {
+                sf::Packet request;
+                sf::Packet reply;
+                sf::Socket::Status status = client.receive(request);
+                if (status == sf::Socket::Done && submit(request, reply))
+                {
+                    client.queue(reply);
+                    alive = client.flush();
+                    if (alive && client.isSending())
+                        selector.remove(client);
+                }
+                else
+                    alive = status == sf::Socket::NotReady; // Part of a request, or nothing yet
+            }
+            if (alive)
+            {
+                i++;
+                continue;
+            }
+
+            // Gone, or the server is stopping
+            selector.remove(client);
+            clients.erase(clients.begin() + i);
+        }
+    }
+
+    // Replies still going out get one last chance, such as the one to SHUTDOWN
+    for (std::unique_ptr<QueuedSocket>& client : clients)
+    {
+        client->flush();
+        client->disconnect();
+    }
+}
+
+bool ControlServer::submit(sf::Packet& request, sf::Packet& reply)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mRequest = request;
+    mHasRequest = true;
+    mHasReply = false;
+    mChanged.notify_all();
+
+    while (mRunning && !mHasReply)
+        mChanged.wait(lock);
+    if (!mHasReply)
+        return false;
+
+    reply = mReply;
+    mHasReply = false;
+    return true;
+}
+
+void ControlServer::fail(sf::Packet& reply, const std::string& message)
+{
+    reply << sf::Uint8(FAILED) << message;
+}
+
+bool ControlServer::isInside(const Grid& board, int x, int y)
+{
+    return x >= 0 && y >= 0 && x < board.getWidth() && y < board.getHeight();
+}
+
+bool ControlServer::isInside(const InfiniteGrid&, int, int)
+{
+    return true;
+}
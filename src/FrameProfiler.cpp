@@ -0,0 +1,139 @@
+#include "FrameProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "Trace.hpp"
+
+namespace
+{
+    const float PixelsPerMs = 20.f;
+    const float RowHeight = 16.f;
+    const float LabelWidth = 210.f; // Room for the labels when there is a font
+
+    const sf::Color PhaseColors[FrameProfiler::PHASE_COUNT] =
+    {
+        sf::Color(128, 128, 128),
+        sf::Color(80, 200, 80),
+        sf::Color(200, 200, 80),
+        sf::Color(80, 200, 200),
+        sf::Color(80, 120, 220),
+        sf::Color(200, 80, 200),
+        sf::Color(200, 120, 60)
+    };
+}
+
+FrameProfiler::FrameProfiler(std::size_t samples) : mLast(Clock::now()), mCapacity(samples > 0 ? samples : 1)
+{
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        mSamples[phase].reserve(mCapacity);
+        mNext[phase] = 0;
+    }
+}
+
+void FrameProfiler::lap(Phase phase)
+{
+    Clock::time_point now = Clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - mLast).count();
+    if (Trace::isEnabled())
+        Trace::record(getPhaseName(phase), "frame", mLast, now);
+    mLast = now;
+
+    std::vector<double>& samples = mSamples[phase];
+    if (samples.size() < mCapacity)
+        samples.push_back(ms);
+    else
+        samples[mNext[phase]] = ms;
+    mNext[phase] = (mNext[phase] + 1) % mCapacity;
+}
+
+double FrameProfiler::getPercentile(Phase phase, double percent) const
+{
+    std::vector<double> sorted = mSamples[phase];
+    if (sorted.empty())
+        return 0.0;
+
+    // Nearest rank
+    std::size_t rank = static_cast<std::size_t>(std::ceil(percent/100.0*sorted.size()));
+    rank = std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+void FrameProfiler::printSummary(std::ostream& out) const
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        Phase phase = static_cast<Phase>(i);
+        line << (i > 0 ? " | " : "") << getPhaseName(phase) << " " << getPercentile(phase, 50) << "/"
+             << getPercentile(phase, 95) << "/" << getPercentile(phase, 99);
+    }
+    out << line.str() << " ms (p50/p95/p99)";
+}
+
+void FrameProfiler::draw(sf::RenderTarget& target, const sf::Font* font) const
+{
+    sf::View previous = target.getView();
+    target.setView(target.getDefaultView());
+
+    sf::RectangleShape background(sf::Vector2f(target.getSize().x, RowHeight*PHASE_COUNT + 8.f));
+    background.setFillColor(sf::Color(0, 0, 0, 160));
+    target.draw(background);
+
+    float left = font ? LabelWidth : 4.f;
+    float maxWidth = std::max(0.f, target.getSize().x - left - 4.f);
+    sf::RectangleShape bar;
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        Phase phase = static_cast<Phase>(i);
+        double p50 = getPercentile(phase, 50);
+        double p95 = getPercentile(phase, 95);
+        double p99 = getPercentile(phase, 99);
+        float top = 4.f + i*RowHeight;
+
+        // p99 faintest at the back, p50 solid in front
+        const double percentiles[3] = {p99, p95, p50};
+        const sf::Uint8 alphas[3] = {70, 140, 255};
+        for (int j = 0; j < 3; j++)
+        {
+            sf::Color color = PhaseColors[i];
+            color.a = alphas[j];
+            bar.setFillColor(color);
+            bar.setPosition(left, top + 2.f);
+            bar.setSize(sf::Vector2f(std::min<float>(percentiles[j]*PixelsPerMs, maxWidth), RowHeight - 4.f));
+            target.draw(bar);
+        }
+
+        if (font)
+        {
+            std::ostringstream label;
+            label << std::fixed << std::setprecision(2) << getPhaseName(phase) << " " << p50 << "/" << p95 << "/" << p99;
+            sf::Text text(label.str(), *font, 12);
+            text.setColor(PhaseColors[i]);
+            text.setPosition(4.f, top);
+            target.draw(text);
+        }
+    }
+
+    target.setView(previous);
+}
+
+const char* FrameProfiler::getPhaseName(Phase phase)
+{
+    switch (phase)
+    {
+        case EVENTS: return "events";
+        case UPDATE: return "update";
+        case EDIT: return "edit";
+        case FLIP: return "flip";
+        case IO: return "io";
+        case DRAW: return "draw";
+        case DISPLAY: return "display";
+        default: return "?";
+    }
+}
@@ -0,0 +1,1201 @@
+#include "Grid.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "MemoryReport.hpp"
+#include "NumaTopology.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    const int BlockSize = 64; // Width and height of the tiles advanced by Grid::advance()
+    const std::size_t MergeRatio = 8; // Cells added to the interesting list are merged into it, rather
+                                      // than radix sorting it all, while they are fewer than 1/8 of it
+
+    const int MaskSlots = 4; // Wire neighbours read without branching. Cells with more read all eight.
+
+    /// \brief The directions of the wire neighbours in each wire mask, padded with direction 8, the
+    /// cell itself. A wire cell isn't a head, so reading it adds nothing to the count.
+    struct MaskDirections
+    {
+        unsigned char direction[256][MaskSlots];
+        bool crowded[256]; // More wire neighbours than slots
+
+        MaskDirections()
+        {
+            for (int mask = 0; mask < 256; mask++)
+            {
+                int count = 0;
+                for (int k = 0; k < 8; k++)
+                {
+                    if (!(mask & (1 << k)))
+                        continue;
+                    if (count < MaskSlots)
+                        direction[mask][count] = k;
+                    count++;
+                }
+                crowded[mask] = count > MaskSlots;
+                for (int slot = count; slot < MaskSlots; slot++)
+                    direction[mask][slot] = 8;
+            }
+        }
+    };
+    const MaskDirections Directions;
+
+    /// \brief Sort indices with two 16-bit passes of an LSD radix sort
+    void radixSort(std::vector<unsigned>& keys)
+    {
+        std::vector<unsigned> scratch(keys.size());
+        std::vector<std::size_t> counts(1 << 16);
+        for (int shift = 0; shift < 32; shift += 16)
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            for (unsigned key : keys)
+                counts[(key >> shift) & 0xFFFF]++;
+
+            std::size_t start = 0;
+            for (std::size_t& count : counts)
+            {
+                std::size_t bucket = count;
+                count = start;
+                start += bucket;
+            }
+            for (unsigned key : keys)
+                scratch[counts[(key >> shift) & 0xFFFF]++] = key;
+            keys.swap(scratch);
+        }
+    }
+
+    // Next state of a cell indexed by its state and its number of head neighbours
+    const unsigned char Transition[4][9] = {
+        {NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE},
+        {WIRE, HEAD, HEAD, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE},
+        {TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL},
+        {WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE}
+    };
+
+    /// \brief A thread per band of a grid, pinned to the band's CPU for as long as the team lasts,
+    /// so every job a band's thread does runs on the same node. One band runs on the calling thread.
+    class BandTeam
+    {
+        public:
+            explicit BandTeam(const std::vector<int>& cpus) : mJob(0), mRound(0), mRunning(0), mStopping(false)
+            {
+                for (std::size_t band = 0; cpus.size() > 1 && band < cpus.size(); band++)
+                    mThreads.emplace_back(&BandTeam::work, this, band, cpus[band]);
+            }
+
+            ~BandTeam()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mStopping = true;
+                }
+                mStart.notify_all();
+                for (std::thread& thread : mThreads)
+                    thread.join();
+            }
+
+            /// \brief Call job(band) for every band on its thread and wait for them all
+            void run(const std::function<void(int)>& job)
+            {
+                if (mThreads.empty())
+                {
+                    job(0);
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(mMutex);
+                mJob = &job;
+                mRunning = mThreads.size();
+                mRound++;
+                mStart.notify_all();
+                mDone.wait(lock, [this] {return mRunning == 0;});
+            }
+
+        private:
+            void work(int band, int cpu)
+            {
+                NumaTopology::pinThread(cpu); // Unpinned threads still work, just wherever they are put
+
+                unsigned round = 0;
+                while (true)
+                {
+                    const std::function<void(int)>* job;
+                    {
+                        std::unique_lock<std::mutex> lock(mMutex);
+                        mStart.wait(lock, [&] {return mStopping || mRound != round;});
+                        if (mStopping)
+                            return;
+                        round = mRound;
+                        job = mJob;
+                    }
+
+                    (*job)(band);
+
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    if (--mRunning == 0)
+                        mDone.notify_one();
+                }
+            }
+
+            std::vector<std::thread> mThreads;
+            std::mutex mMutex;
+            std::condition_variable mStart;
+            std::condition_variable mDone;
+            const std::function<void(int)>* mJob; // Guarded by mMutex, like the rest
+            unsigned mRound; // Bumped for every job
+            int mRunning; // Threads still on the current job
+            bool mStopping;
+    };
+
+    /// \brief Scramble the bits of a value (the splitmix64 finaliser)
+    unsigned long long mix(unsigned long long value)
+    {
+        value = (value ^ (value >> 30))*0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27))*0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+}
+
+Grid::Grid(int width, int height) : mWidth(width), mHeight(height), mLayout(ROWS), mTileColumns(0),
+    mThreads(1), mFirstTouch(true), mSortedCells(0), mEdited(false), mEngine(REFERENCE), mCountsValid(false), mCountsStepped(false), mRowWords(0),
+    mHeadBitsValid(false), mGroupsValid(false)
+{
+    allocate();
+}
+
+Grid::~Grid()
+{
+}
+
+bool Grid::loadFromFile(const std::string& filename)
+{
+    return loadFromFile(filename, 0, 0, 0, 0);
+}
+
+bool Grid::loadFromFile(const std::string& filename, int left, int top, int columns, int rows)
+{
+    TraceScope trace("load", "io");
+
+    std::ifstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    int width = 0;
+    int height = 0;
+
+    // First load grid dims and reset the grid
+    file >> width >> height;
+    if (!file || width <= 0 || height <= 0)
+        return false;
+    if (columns <= 0)
+        columns = width;
+    if (rows <= 0)
+        rows = height;
+
+    mWidth = columns;
+    mHeight = rows;
+    allocate();
+    mInteresting.clear();
+    mSortedCells = 0;
+    mGroups.clear();
+    mGroupsValid = false;
+
+    // Now load the data. A cell of the file lands on every cell of the grid a whole number of file
+    // widths and heights away from its place relative to the corner, if any.
+    std::vector<int> targets;
+    int firstColumn = ((-left) % width + width) % width;
+    for (int y = 0; y < height; y++)
+    {
+        targets.clear();
+        for (int row = ((y - top) % height + height) % height; row < rows; row += height)
+            targets.push_back(row);
+        if (targets.empty())
+        {
+            file.ignore(width + 1); // The row and its new line
+            continue;
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            char c = file.get();
+            CellState cell = NONE;
+            if (c == '#')
+                cell = WIRE;
+            else if (c == '@')
+                cell = HEAD;
+            else if (c == '~')
+                cell = TAIL;
+            else if (c != ' ')
+                continue;
+            int column = x + firstColumn < width ? x + firstColumn : x + firstColumn - width;
+            for (; column < columns; column += width)
+            {
+                for (int row : targets)
+                    setCell(column, row, cell);
+            }
+        }
+        file.get(); // skip the new line
+    }
+
+    return true;
+}
+
+bool Grid::readSize(const std::string& filename, int& width, int& height)
+{
+    std::ifstream file(filename.c_str());
+    file >> width >> height;
+    return file && width > 0 && height > 0;
+}
+
+bool Grid::saveToFile(const std::string& filename) const
+{
+    TraceScope trace("save", "io");
+
+    std::ofstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    // loadFromFile() reads the first row straight after the dimensions, so no new line there
+    static const char symbols[] = {' ', '#', '@', '~'};
+    file << mWidth << " " << mHeight;
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+            file.put(symbols[getCell(x, y)]);
+        file.put('\n');
+    }
+
+    return static_cast<bool>(file);
+}
+
+void Grid::setLayout(Layout layout)
+{
+    if (layout == mLayout)
+        return;
+
+    std::vector<Cell> cells;
+    cells.reserve(mWidth*mHeight);
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+            cells.push_back(mCells[getIndex(x, y)]);
+    }
+    std::vector<Position> positions;
+    positions.reserve(mInteresting.size());
+    for (unsigned index : mInteresting)
+        positions.push_back(getPosition(index));
+
+    mLayout = layout;
+    allocate();
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+            mCells[getIndex(x, y)] = cells[y*mWidth + x];
+    }
+    for (std::size_t i = 0; i < positions.size(); i++)
+        mInteresting[i] = getIndex(positions[i].x, positions[i].y);
+    mSortedCells = 0;
+    mGroupsValid = false;
+}
+
+Grid::Position Grid::getPosition(unsigned index) const
+{
+    if (mLayout == ROWS)
+        return Position{static_cast<int>(index % mWidth), static_cast<int>(index / mWidth)};
+    unsigned tile = index >> 6;
+    return Position{static_cast<int>((tile % mTileColumns) << 3 | (index & 7)),
+                    static_cast<int>((tile / mTileColumns) << 3 | ((index >> 3) & 7))};
+}
+
+void Grid::sortInteresting()
+{
+    if (mSortedCells == mInteresting.size())
+        return;
+
+    TraceScope trace("sort", "sim");
+    std::size_t added = mInteresting.size() - mSortedCells;
+    if (added*MergeRatio < mSortedCells)
+    {
+        std::vector<unsigned>::iterator middle = mInteresting.begin() + mSortedCells;
+        std::sort(middle, mInteresting.end());
+        std::inplace_merge(mInteresting.begin(), middle, mInteresting.end());
+    }
+    else
+        radixSort(mInteresting);
+
+    // Drop duplicates and cells which have emptied, which are no longer wires to their neighbours
+    std::size_t kept = 0;
+    for (unsigned index : mInteresting)
+    {
+        const Cell& cell = mCells[index];
+        if (kept > 0 && mInteresting[kept-1] == index)
+            continue;
+        if (cell.current == NONE && cell.next == NONE)
+        {
+            if (!mWires.empty())
+            {
+                Position pos = getPosition(index);
+                markWire(pos.x, pos.y, false);
+            }
+            continue;
+        }
+        mInteresting[kept++] = index;
+    }
+    mInteresting.resize(kept);
+    mSortedCells = kept;
+    mGroupsValid = false;
+}
+
+void Grid::markWire(int x, int y, bool wire)
+{
+    if (mWires.empty())
+        return;
+
+    int left = wrapX(x-1);
+    int right = wrapX(x+1);
+    int top = wrapY(y-1);
+    int bottom = wrapY(y+1);
+
+    // Each neighbour sees this cell in the opposite direction
+    const int neighbours[8][3] = {
+        {left, top, BOTTOM_RIGHT}, {x, top, BOTTOM}, {right, top, BOTTOM_LEFT},
+        {left, y, RIGHT}, {right, y, LEFT},
+        {left, bottom, TOP_RIGHT}, {x, bottom, TOP}, {right, bottom, TOP_LEFT}
+    };
+    for (const int* neighbour : neighbours)
+    {
+        unsigned char& wires = mWires[getIndex(neighbour[0], neighbour[1])];
+        if (wire)
+            wires |= neighbour[2];
+        else
+            wires &= ~neighbour[2];
+    }
+}
+
+void Grid::buildWires()
+{
+    TraceScope trace("wire masks", "sim");
+
+    mWires.assign(mCells.size(), 0);
+    for (unsigned index : mInteresting)
+    {
+        if (mCells[index].current == NONE && mCells[index].next == NONE)
+            continue;
+        Position pos = getPosition(index);
+        markWire(pos.x, pos.y, true);
+    }
+}
+
+void Grid::getNeighbours(unsigned index, unsigned neighbours[8]) const
+{
+    Position pos = getPosition(index);
+    int left = wrapX(pos.x-1);
+    int right = wrapX(pos.x+1);
+    int top = wrapY(pos.y-1);
+    int bottom = wrapY(pos.y+1);
+
+    neighbours[0] = getIndex(left, top);
+    neighbours[1] = getIndex(pos.x, top);
+    neighbours[2] = getIndex(right, top);
+    neighbours[3] = getIndex(left, pos.y);
+    neighbours[4] = getIndex(right, pos.y);
+    neighbours[5] = getIndex(left, bottom);
+    neighbours[6] = getIndex(pos.x, bottom);
+    neighbours[7] = getIndex(right, bottom);
+}
+
+void Grid::buildHeadCounts()
+{
+    TraceScope trace("head counts", "sim");
+
+    mHeadCounts.assign(mCells.size(), 0);
+    mHeads.clear();
+    mTails.clear();
+    for (unsigned index : mInteresting)
+    {
+        if (mCells[index].current == TAIL)
+            mTails.push_back(index);
+        if (mCells[index].current != HEAD)
+            continue;
+        mHeads.push_back(index);
+
+        unsigned neighbours[8];
+        getNeighbours(index, neighbours);
+        for (unsigned neighbour : neighbours)
+            mHeadCounts[neighbour]++;
+    }
+    mCountsValid = true;
+}
+
+void Grid::updateIncremental()
+{
+    if (!mCountsValid)
+        buildHeadCounts();
+
+    // Only wires next to a head can fire, and a wire fires with one or two heads around it
+    mFired.clear();
+    for (unsigned head : mHeads)
+    {
+        unsigned neighbours[8];
+        getNeighbours(head, neighbours);
+        for (unsigned neighbour : neighbours)
+        {
+            Cell& cell = mCells[neighbour];
+            if (cell.current == WIRE && cell.next != HEAD && mHeadCounts[neighbour] <= 2)
+            {
+                cell.next = HEAD;
+                mFired.push_back(neighbour);
+            }
+        }
+    }
+
+    for (unsigned head : mHeads)
+        mCells[head].next = TAIL;
+    for (unsigned tail : mTails)
+        mCells[tail].next = WIRE;
+    mCountsStepped = true;
+}
+
+void Grid::flipIncremental()
+{
+    unsigned neighbours[8];
+    for (unsigned fired : mFired)
+    {
+        mCells[fired].current = HEAD;
+        getNeighbours(fired, neighbours);
+        for (unsigned neighbour : neighbours)
+            mHeadCounts[neighbour]++;
+    }
+    for (unsigned head : mHeads)
+    {
+        mCells[head].current = TAIL;
+        getNeighbours(head, neighbours);
+        for (unsigned neighbour : neighbours)
+            mHeadCounts[neighbour]--;
+    }
+    for (unsigned tail : mTails)
+        mCells[tail].current = WIRE;
+
+    // The heads become tails and the wires which fired become heads
+    mTails.swap(mHeads);
+    mHeads.swap(mFired);
+    mCountsStepped = false;
+}
+
+void Grid::allocate()
+{
+    mWires.clear(); // Rebuilt by the MASKED engine for the new cells
+    mCountsValid = false;
+
+    // Partial tiles at the right and bottom edges are padded with empty cells
+    mTileColumns = mLayout == ROWS ? 0 : (mWidth + 7)/8;
+    std::size_t size = mLayout == ROWS ? mWidth*mHeight : mTileColumns*((mHeight + 7)/8)*64;
+
+    mCells = Cells(); // Free the old cells first, rather than holding both
+    mCells.resize(size);
+    touchCells(mCells, 0);
+}
+
+void Grid::setThreads(int threads, bool firstTouch)
+{
+    mThreads = std::max(1, threads);
+    mFirstTouch = firstTouch;
+
+    Cells cells(mCells.size());
+    touchCells(cells, &mCells);
+    mCells.swap(cells);
+}
+
+void Grid::touchCells(Cells& cells, const Cells* from) const
+{
+    BandTeam team(mFirstTouch ? getBandCpus() : std::vector<int>());
+    team.run([&](int band) {
+        std::size_t first = mFirstTouch ? getBandCell(band) : 0;
+        std::size_t last = mFirstTouch ? getBandCell(band + 1) : cells.size();
+        if (from)
+            std::copy(from->begin() + first, from->begin() + last, cells.begin() + first);
+        else
+            std::fill(cells.begin() + first, cells.begin() + last, Cell{NONE, NONE});
+    });
+}
+
+int Grid::getBandCount() const
+{
+    int tileRows = (mHeight + BlockSize - 1)/BlockSize;
+    return std::max(1, std::min(mThreads, tileRows));
+}
+
+int Grid::getBandRow(int band) const
+{
+    int tileRows = (mHeight + BlockSize - 1)/BlockSize;
+    return std::min(mHeight, band*tileRows/getBandCount()*BlockSize);
+}
+
+std::size_t Grid::getBandCell(int band) const
+{
+    // Bands start on a multiple of 64 rows, so in either layout they are runs of whole rows of cells
+    if (band >= getBandCount())
+        return mCells.size();
+    return getIndex(0, getBandRow(band));
+}
+
+std::vector<int> Grid::getBandCpus() const
+{
+    std::vector<int> cpus;
+    int bands = getBandCount();
+    for (int band = 0; bands > 1 && band < bands; band++)
+        cpus.push_back(NumaTopology::getMachine().getCpu(band, bands));
+    return cpus;
+}
+
+void Grid::printNumaReport(std::ostream& out) const
+{
+    const NumaTopology& machine = NumaTopology::getMachine();
+    int bands = getBandCount();
+    std::vector<int> cpus = getBandCpus();
+    out << machine.getNodeCount() << (machine.getNodeCount() == 1 ? " NUMA node, " : " NUMA nodes, ")
+        << machine.getCpuCount() << " CPUs, " << bands << (bands == 1 ? " band" : " bands") << " of rows on "
+        << mThreads << (mThreads == 1 ? " thread" : " threads")
+        << (mFirstTouch || bands == 1 ? "" : ", cells placed by one thread") << "\n";
+
+    for (int band = 0; band < bands; band++)
+    {
+        out << "  rows " << getBandRow(band) << "-" << getBandRow(band + 1) - 1 << ": ";
+        if (cpus.empty())
+            out << "calling thread";
+        else
+            out << "cpu " << cpus[band] << " on node " << machine.getNode(cpus[band]);
+
+        std::size_t first = getBandCell(band);
+        std::size_t last = getBandCell(band + 1);
+        std::vector<std::size_t> pages;
+        std::size_t untouched;
+        if (first == last || !NumaTopology::countPages(&mCells[first], (last - first)*sizeof(Cell), pages, untouched))
+        {
+            out << ", cells on unknown nodes\n";
+            continue;
+        }
+        out << ", cells";
+        for (std::size_t node = 0; node < pages.size(); node++)
+        {
+            if (pages[node] > 0)
+                out << " " << pages[node] << (pages[node] == 1 ? " page" : " pages") << " on node " << node;
+        }
+        if (untouched > 0)
+            out << " " << untouched << " untouched";
+        out << "\n";
+    }
+}
+
+void Grid::setEngine(Engine engine)
+{
+    mEngine = engine;
+    if (mEngine == MASKED && mWires.empty())
+        buildWires();
+}
+
+void Grid::update()
+{
+    TraceScope trace("update", "sim");
+
+    sortInteresting();
+
+    if (mEngine == INCREMENTAL)
+    {
+        updateIncremental();
+        mHeadBitsValid = false;
+        return;
+    }
+    mCountsValid = false;
+
+    if (mEngine == LOOKUP)
+    {
+        updateLookup();
+        return;
+    }
+    mHeadBitsValid = false;
+
+    if (mEngine == MASKED)
+    {
+        if (mWires.empty())
+            buildWires();
+        if (mLayout == ROWS)
+            updateCells<ROWS, true>();
+        else
+            updateCells<TILES, true>();
+    }
+    else if (mLayout == ROWS)
+        updateCells<ROWS, false>();
+    else
+        updateCells<TILES, false>();
+}
+
+template <Grid::Layout L, bool Masked>
+void Grid::updateCells()
+{
+    // Offsets of the neighbours in the order of the wire mask bits, away from the edges
+    const int stride = L == ROWS ? mWidth : 8;
+    const int offsets[9] = {-stride-1, -stride, -stride+1, -1, 1, stride-1, stride, stride+1, 0};
+    int maskOffsets[Masked ? 256 : 1][MaskSlots];
+    for (int mask = 0; Masked && mask < 256; mask++)
+    {
+        for (int slot = 0; slot < MaskSlots; slot++)
+            maskOffsets[mask][slot] = offsets[Directions.direction[mask][slot]];
+    }
+
+    Cursor<L> cursor(*this);
+    for (unsigned index : mInteresting)
+    {
+        Position pos = cursor(index);
+        int x = pos.x;
+        int y = pos.y;
+
+        Cell& cell = mCells[index];
+
+        switch (cell.current)
+        {
+            case WIRE: // wire logic
+            {
+                int neighbors = 0; // Number of neighbor electron heads
+
+                // Away from the edges of the grid (and of the tile, for TILES) the neighbours are
+                // at fixed offsets from the cell
+                bool inside = L == ROWS ? x > 0 && y > 0 && x + 1 < mWidth && y + 1 < mHeight
+                                        : ((x + 1) & 7) > 1 && ((y + 1) & 7) > 1 && x + 1 < mWidth && y + 1 < mHeight;
+                const Cell* c = &cell;
+                unsigned wires = Masked ? mWires[index] : 0;
+                if (Masked && inside && !Directions.crowded[wires])
+                {
+                    // Only the neighbours which are wires can be heads. Thin wires have two to four.
+                    const int* slots = maskOffsets[wires];
+                    neighbors = (c[slots[0]].current == HEAD) + (c[slots[1]].current == HEAD) +
+                                (c[slots[2]].current == HEAD) + (c[slots[3]].current == HEAD);
+                }
+                else if (inside)
+                {
+                    neighbors = (c[offsets[0]].current == HEAD) + (c[offsets[1]].current == HEAD) + (c[offsets[2]].current == HEAD) +
+                                (c[offsets[3]].current == HEAD) + (c[offsets[4]].current == HEAD) +
+                                (c[offsets[5]].current == HEAD) + (c[offsets[6]].current == HEAD) + (c[offsets[7]].current == HEAD);
+                }
+                else
+                {
+                    int left = wrapX(x-1);
+                    int right = wrapX(x+1);
+                    int top = wrapY(y-1);
+                    int bottom = wrapY(y+1);
+
+                    if (mCells[getIndex<L>(left, top)].current == HEAD) neighbors++; // top left
+                    if (mCells[getIndex<L>(x, top)].current == HEAD) neighbors++; // top mid
+                    if (mCells[getIndex<L>(right, top)].current == HEAD) neighbors++; // top right
+
+                    if (mCells[getIndex<L>(left, y)].current == HEAD) neighbors++; // mid left
+                    if (mCells[getIndex<L>(right, y)].current == HEAD) neighbors++; // mid right
+
+                    if (mCells[getIndex<L>(left, bottom)].current == HEAD) neighbors++; // bot left
+                    if (mCells[getIndex<L>(x, bottom)].current == HEAD) neighbors++; // bot mid
+                    if (mCells[getIndex<L>(right, bottom)].current == HEAD) neighbors++; // bot right
+                }
+
+                if (neighbors == 1 || neighbors == 2)
+                    cell.next = HEAD; // becomes electron head
+
+                break;
+            }
+
+            case HEAD: // electron head logic
+            {
+                cell.next = TAIL;
+                break;
+            }
+
+            case TAIL: // electron tail logic
+            {
+                cell.next = WIRE;
+                break;
+            }
+        }
+    }
+}
+
+void Grid::updateLookup()
+{
+    // Which of four cells would fire if they were wire, indexed by the number of heads in the six
+    // columns around them (three rows each). Column counts are split into low bits (bits 0-5) and
+    // high bits (bits 6-11). A wire cell isn't a head, so its own column adds nothing.
+    static unsigned char fire[1 << 12];
+    static bool built = false;
+    if (!built)
+    {
+        for (int index = 0; index < (1 << 12); index++)
+        {
+            int count[6];
+            for (int c = 0; c < 6; c++)
+                count[c] = ((index >> c) & 1) + 2*((index >> (c + 6)) & 1);
+
+            fire[index] = 0;
+            for (int j = 0; j < 4; j++)
+            {
+                int heads = count[j] + count[j+1] + count[j+2];
+                if (heads == 1 || heads == 2)
+                    fire[index] |= 1 << j;
+            }
+        }
+        built = true;
+    }
+
+    // Cells which don't change map to themselves, which is only right while every pending state is
+    // the current one. Cells set since the last flip() keep their pending state instead, as in
+    // updateCells(): only the cells which change are or'ed into what the mask keeps.
+    static const CellState transition[4][2] = {{NONE, NONE}, {WIRE, HEAD}, {TAIL, TAIL}, {WIRE, WIRE}};
+    static const unsigned char changes[4][2] = {{NONE, NONE}, {NONE, HEAD}, {TAIL, TAIL}, {WIRE, WIRE}};
+    static const unsigned char kept[4][2] = {{0xFF, 0xFF}, {0xFF, 0}, {0, 0}, {0, 0}};
+    const bool edited = mEdited;
+
+    // Groups only change when cells become interesting
+    if (!mGroupsValid)
+    {
+        mRowWords = (mWidth + 63)/64;
+        mHeadBits.assign(mRowWords*mHeight, 0);
+        mNextHeadBits.assign(mRowWords*mHeight, 0);
+        mHeadBitsValid = false;
+
+        std::vector<int> cells;
+        for (unsigned index : mInteresting)
+        {
+            Position pos = getPosition(index);
+            cells.push_back(pos.y*mWidth + (pos.x & ~3));
+        }
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+        mGroups.clear();
+        mGroupRows.assign(mHeight + 1, 0);
+        for (int cell : cells)
+        {
+            mGroups.push_back(cell % mWidth);
+            mGroupRows[cell / mWidth + 1]++;
+        }
+        for (int y = 0; y < mHeight; y++)
+            mGroupRows[y+1] += mGroupRows[y];
+        mGroupsValid = true;
+    }
+
+    // Pack the head bits, a nibble per group. After the first generation they come from the
+    // previous update, unless cells were set in between.
+    if (!mHeadBitsValid)
+    {
+        for (int y = 0; y < mHeight; y++)
+        {
+            unsigned long long* words = &mHeadBits[y*mRowWords];
+            for (int k = mGroupRows[y]; k < mGroupRows[y+1]; k++)
+            {
+                int x = mGroups[k];
+                const Cell* cells = &mCells[getIndex(x, y)];
+                unsigned nibble = 0;
+                for (int j = 0; j < 4 && x + j < mWidth; j++)
+                    nibble |= (cells[j].current == HEAD) << j;
+                setNibble(words, x, nibble);
+            }
+        }
+    }
+
+    for (int y = 0; y < mHeight; y++)
+    {
+        const unsigned long long* above = &mHeadBits[wrapY(y-1)*mRowWords];
+        const unsigned long long* middle = &mHeadBits[y*mRowWords];
+        const unsigned long long* below = &mHeadBits[wrapY(y+1)*mRowWords];
+        unsigned long long* nextHeads = &mNextHeadBits[y*mRowWords];
+        for (int k = mGroupRows[y]; k < mGroupRows[y+1]; k++)
+        {
+            int x = mGroups[k];
+
+            // Head bits of columns x-1 to x+4 in the three rows
+            unsigned a, b, c;
+            if (x > 0 && x + 5 <= mWidth)
+            {
+                int word = (x - 1) >> 6;
+                int shift = (x - 1) & 63;
+                if (shift <= 58)
+                {
+                    a = (above[word] >> shift) & 63;
+                    b = (middle[word] >> shift) & 63;
+                    c = (below[word] >> shift) & 63;
+                }
+                else
+                {
+                    a = ((above[word] >> shift) | (above[word+1] << (64 - shift))) & 63;
+                    b = ((middle[word] >> shift) | (middle[word+1] << (64 - shift))) & 63;
+                    c = ((below[word] >> shift) | (below[word+1] << (64 - shift))) & 63;
+                }
+            }
+            else
+            {
+                a = headBits(wrapY(y-1), x-1);
+                b = headBits(y, x-1);
+                c = headBits(wrapY(y+1), x-1);
+            }
+
+            // Per-column head counts, split into low and high bits
+            unsigned low = a ^ b ^ c;
+            unsigned high = (a & b) | (a & c) | (b & c);
+            unsigned fires = fire[(high << 6) | low];
+
+            // Unless cells were set, the whole group is written without branching. The wires which
+            // fire are the heads of the next generation.
+            Cell* cells = &mCells[getIndex(x, y)];
+            unsigned wires = 0;
+            if (x + 4 <= mWidth && !edited)
+            {
+                cells[0].next = transition[cells[0].current][fires & 1];
+                cells[1].next = transition[cells[1].current][(fires >> 1) & 1];
+                cells[2].next = transition[cells[2].current][(fires >> 2) & 1];
+                cells[3].next = transition[cells[3].current][(fires >> 3) & 1];
+                wires = (cells[0].current == WIRE) | (cells[1].current == WIRE) << 1 |
+                        (cells[2].current == WIRE) << 2 | (cells[3].current == WIRE) << 3;
+            }
+            else
+            {
+                for (int j = 0; j < 4 && x + j < mWidth; j++)
+                {
+                    unsigned fired = (fires >> j) & 1;
+                    unsigned current = cells[j].current;
+                    if (edited)
+                        cells[j].next = (cells[j].next & kept[current][fired]) | changes[current][fired];
+                    else
+                        cells[j].next = transition[current][fired];
+                    wires |= (cells[j].current == WIRE) << j;
+                }
+            }
+            setNibble(nextHeads, x, wires & fires);
+        }
+    }
+
+    // Cells set since the last flip() aren't in the new head bits, so they are packed again next time
+    mHeadBits.swap(mNextHeadBits);
+    mHeadBitsValid = !mEdited;
+}
+
+void Grid::setNibble(unsigned long long* words, int x, unsigned nibble)
+{
+    unsigned long long& word = words[x >> 6];
+    word = (word & ~(0xFull << (x & 63))) | (static_cast<unsigned long long>(nibble) << (x & 63));
+}
+
+unsigned Grid::headBits(int row, int x) const
+{
+    const unsigned long long* words = &mHeadBits[row*mRowWords];
+    unsigned bits = 0;
+    for (int c = 0; c < 6; c++)
+    {
+        int column = wrapX(x + c);
+        bits |= ((words[column >> 6] >> (column & 63)) & 1) << c;
+    }
+    return bits;
+}
+
+void Grid::flip()
+{
+    TraceScope trace("flip", "sim");
+
+    sortInteresting();
+
+    // Cells set since the last flip() are only committed by copying every cell
+    if (mCountsStepped && mCountsValid && !mEdited)
+    {
+        flipIncremental();
+        return;
+    }
+    mCountsStepped = false;
+    mCountsValid = false;
+    mEdited = false;
+
+    for (unsigned index : mInteresting)
+        mCells[index].current = mCells[index].next;
+}
+
+void Grid::advance(long long generations, int depth)
+{
+    // The tiles are read from the current states, so cells set since the last flip() go in first
+    if (mEdited)
+        flip();
+
+    depth = std::max(1, std::min(depth, BlockSize)); // The scratch buffers grow with the square of it
+    int bands = getBandCount();
+    BandTeam team(getBandCpus());
+    std::vector<std::vector<unsigned char>> front(bands);
+    std::vector<std::vector<unsigned char>> back(bands);
+
+    // Only conductors can change, so the lists hold for the whole call
+    Blocks blocks;
+    std::vector<std::size_t> bandBlocks(bands + 1); // First tile of each band in blocks
+    int built = 0;
+
+    // Each band's thread flips its own run of the interesting list, which no one changes meanwhile
+    std::vector<std::size_t> bandCells(bands + 1, 0);
+    if (bands > 1)
+    {
+        sortInteresting();
+        for (int band = 0; band <= bands; band++)
+        {
+            bandCells[band] = std::lower_bound(mInteresting.begin(), mInteresting.end(), getBandCell(band)) -
+                              mInteresting.begin();
+        }
+        mCountsStepped = false;
+        mCountsValid = false;
+        mEdited = false;
+    }
+
+    while (generations > 0)
+    {
+        TraceScope pass("pass", "sim");
+        int steps = static_cast<int>(std::min<long long>(generations, depth));
+
+        if (steps != built)
+        {
+            buildBlocks(steps, blocks);
+            std::size_t tile = 0;
+            for (int band = 0; band <= bands; band++)
+            {
+                while (tile + 1 < blocks.start.size() && blocks.origin[2*tile+1] < getBandRow(band))
+                    tile++;
+                bandBlocks[band] = band < bands ? tile : blocks.start.size() - 1;
+            }
+            built = steps;
+        }
+
+        if (bands == 1)
+        {
+            advanceBlocks(blocks, 0, blocks.start.size() - 1, steps, front[0], back[0]);
+            flip();
+        }
+        else
+        {
+            // Other bands' tiles read the current states of this band's edges until they are all done
+            team.run([&](int band) {
+                advanceBlocks(blocks, bandBlocks[band], bandBlocks[band+1], steps, front[band], back[band]);
+            });
+            team.run([&](int band) {
+                for (std::size_t i = bandCells[band]; i < bandCells[band+1]; i++)
+                    mCells[mInteresting[i]].current = mCells[mInteresting[i]].next;
+            });
+        }
+        generations -= steps;
+    }
+
+    mHeadBitsValid = false;
+}
+
+void Grid::buildBlocks(int steps, Blocks& blocks) const
+{
+    blocks.start.assign(1, 0);
+    blocks.origin.clear();
+    blocks.source.clear();
+    blocks.localX.clear();
+    blocks.localY.clear();
+    for (int ty = 0; ty < mHeight; ty += BlockSize)
+    {
+        for (int tx = 0; tx < mWidth; tx += BlockSize)
+        {
+            int w = std::min(BlockSize, mWidth - tx) + 2*steps;
+            int h = std::min(BlockSize, mHeight - ty) + 2*steps;
+            for (int y = 0; y < h; y++)
+            {
+                int row = wrapY(ty + y - steps);
+                for (int x = 0; x < w; x++)
+                {
+                    int cell = getIndex(wrapX(tx + x - steps), row);
+                    if (mCells[cell].current == NONE)
+                        continue;
+                    blocks.source.push_back(cell);
+                    blocks.localX.push_back(x);
+                    blocks.localY.push_back(y);
+                }
+            }
+            if (static_cast<int>(blocks.source.size()) == blocks.start.back())
+                continue; // Nothing to do here
+            blocks.start.push_back(blocks.source.size());
+            blocks.origin.push_back(tx);
+            blocks.origin.push_back(ty);
+        }
+    }
+}
+
+void Grid::advanceBlocks(const Blocks& blocks, std::size_t first, std::size_t last, int steps,
+                         std::vector<unsigned char>& front, std::vector<unsigned char>& back)
+{
+    int span = BlockSize + 2*steps; // Tile plus halo on both sides
+    front.resize(span*span);
+    back.resize(span*span);
+    std::vector<unsigned char> wired(span); // Rows of the scratch buffer with conductors
+    std::vector<unsigned char> columnHeads(span);
+
+    for (std::size_t b = first; b < last; b++)
+    {
+        TraceScope task("tile", "sim");
+        int tx = blocks.origin[2*b];
+        int ty = blocks.origin[2*b+1];
+        int tileW = std::min(BlockSize, mWidth - tx);
+        int tileH = std::min(BlockSize, mHeight - ty);
+        int w = tileW + 2*steps;
+        int h = tileH + 2*steps;
+
+        // Load the tile and its halo. Tiles with no electrons in reach can't change.
+        std::fill(front.begin(), front.begin() + w*h, NONE);
+        std::fill(back.begin(), back.begin() + w*h, NONE);
+        std::fill(wired.begin(), wired.begin() + h, 0);
+        bool live = false;
+        for (int k = blocks.start[b]; k < blocks.start[b+1]; k++)
+        {
+            unsigned char cell = mCells[blocks.source[k]].current;
+            front[blocks.localY[k]*w + blocks.localX[k]] = cell;
+            wired[blocks.localY[k]] = 1;
+            live = live || cell != WIRE;
+        }
+        if (!live)
+            continue;
+
+        // Sweep the whole buffer each generation, counting the heads around each cell from the
+        // heads in each column of three rows, without branching. Each generation is only valid one
+        // cell further in from the edge of the halo. Rows without conductors stay empty.
+        unsigned char* cur = &front[0];
+        unsigned char* next = &back[0];
+        for (int g = 1; g <= steps; g++)
+        {
+            for (int y = g; y < h - g; y++)
+            {
+                if (!wired[y])
+                    continue;
+
+                const unsigned char* above = cur + (y-1)*w;
+                const unsigned char* row = above + w;
+                const unsigned char* below = row + w;
+                for (int x = g - 1; x < w - g + 1; x++)
+                    columnHeads[x] = (above[x] == HEAD) + (row[x] == HEAD) + (below[x] == HEAD);
+
+                unsigned char* out = next + y*w;
+                for (int x = g; x < w - g; x++)
+                {
+                    unsigned char cell = row[x];
+                    unsigned char around = columnHeads[x-1] + columnHeads[x] + columnHeads[x+1] - (cell == HEAD);
+                    unsigned char fires = static_cast<unsigned char>(around - 1) < 2; // One or two
+                    out[x] = (cell == WIRE)*(WIRE + fires) + (cell == HEAD)*TAIL + (cell == TAIL)*WIRE;
+                }
+            }
+            std::swap(cur, next);
+        }
+
+        // Write back the interior. Other tiles still read the current state, so it goes to next.
+        for (int k = blocks.start[b]; k < blocks.start[b+1]; k++)
+        {
+            int x = blocks.localX[k];
+            int y = blocks.localY[k];
+            if (x >= steps && y >= steps && x < steps + tileW && y < steps + tileH)
+                mCells[blocks.source[k]].next = cur[y*w + x];
+        }
+    }
+}
+
+bool Grid::hasHeads() const
+{
+    for (unsigned index : mInteresting)
+    {
+        if (mCells[index].current == HEAD)
+            return true;
+    }
+    return false;
+}
+
+unsigned long long Grid::getStateHash() const
+{
+    // A sum doesn't depend on the order of the interesting list. Every flip() leaves each cell in
+    // it once.
+    unsigned long long hash = 0;
+    for (unsigned index : mInteresting)
+    {
+        unsigned cell = mCells[index].current;
+        if (cell == HEAD || cell == TAIL)
+            hash += mix(4ull*index + cell);
+    }
+    return hash;
+}
+
+void Grid::reportMemory(MemoryReport& report) const
+{
+    report.add("cells", mCells.size()*sizeof(Cell), mCells.capacity()*sizeof(Cell));
+
+    // Entries repeated since setCell() last saw the cell empty, or left behind by erased cells. The
+    // next flip() drops them.
+    std::size_t wasted = 0;
+    std::vector<bool> seen(mCells.size(), false);
+    for (unsigned index : mInteresting)
+    {
+        if (seen[index] || (mCells[index].current == NONE && mCells[index].next == NONE))
+            wasted++;
+        seen[index] = true;
+    }
+    report.add("interesting list", mInteresting.size()*sizeof(unsigned), mInteresting.capacity()*sizeof(unsigned),
+               wasted*sizeof(unsigned));
+
+    std::size_t used = (mHeadBits.size() + mNextHeadBits.size())*sizeof(unsigned long long) +
+                       (mGroups.size() + mGroupRows.size())*sizeof(int);
+    std::size_t reserved = (mHeadBits.capacity() + mNextHeadBits.capacity())*sizeof(unsigned long long) +
+                           (mGroups.capacity() + mGroupRows.capacity())*sizeof(int);
+    report.add("lookup engine", used, reserved);
+    report.add("wire masks", mWires.size(), mWires.capacity());
+
+    used = mHeadCounts.size() + (mHeads.size() + mTails.size() + mFired.size())*sizeof(unsigned);
+    reserved = mHeadCounts.capacity() + (mHeads.capacity() + mTails.capacity() + mFired.capacity())*sizeof(unsigned);
+    report.add("head counts", used, reserved);
+}
+
+void Grid::setCell(int x, int y, CellState cell)
+{
+    if (x < 0 || y < 0 || x >= mWidth || y >= mHeight)
+        return;
+
+    unsigned index = getIndex(x, y);
+    Cell& target = mCells[index];
+    mEdited = true;
+    if (target.next == 0 && cell != 0)
+    {
+        mInteresting.push_back(index);
+        markWire(x, y, true);
+    }
+    target.next = cell;
+    mHeadBitsValid = false;
+}
+
+int Grid::wrapX(int x) const
+{
+    if (x < 0)
+    {
+        x = x % mWidth;
+        if (x < 0)
+            x += mWidth;
+    }
+    else if (x >= mWidth)
+        x = x % mWidth;
+
+    return x;
+}
+
+int Grid::wrapY(int y) const
+{
+    if (y < 0)
+    {
+        y = y % mHeight;
+        if (y < 0)
+            y += mHeight;
+    }
+    else if (y >= mHeight)
+        y = y % mHeight;
+
+    return y;
+}
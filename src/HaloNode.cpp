@@ -0,0 +1,562 @@
+#include "HaloNode.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "Grid.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    const int ConnectSeconds = 60; // How long to wait for the neighbours to start
+
+    // Next state of a cell indexed by its state and its number of head neighbours
+    const unsigned char Transition[4][9] = {
+        {NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE},
+        {WIRE, HEAD, HEAD, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE},
+        {TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL},
+        {WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE}
+    };
+
+    /// \brief Scramble the bits of a value, as Grid::getStateHash() does (the splitmix64 finaliser)
+    unsigned long long mix(unsigned long long value)
+    {
+        value = (value ^ (value >> 30))*0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27))*0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+}
+
+HaloNode::Link::Link() : neighbour(0), closed(false)
+{
+}
+
+HaloNode::HaloNode(int columns, int rows, int rank, int halo) : mNodeColumns(columns), mNodeRows(rows), mRank(rank),
+    mHalo(halo), mBoardWidth(0), mBoardHeight(0), mLeft(0), mTop(0), mWidth(0), mHeight(0), mSpan(0), mCells(0),
+    mExchangeCells(0), mExchangeDone(false), mRunning(false), mSeconds(0.0), mHeads(0), mTails(0)
+{
+    mTotals[0] = mTotals[1] = mTotals[2] = 0;
+}
+
+HaloNode::~HaloNode()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunning = false;
+        mChanged.notify_all();
+    }
+    if (mExchanger.joinable())
+        mExchanger.join();
+
+    // Each receiver stops at the BYE from the other end, or when the connection drops
+    for (Link& link : mLinks)
+    {
+        if (link.socket)
+        {
+            sf::Packet packet;
+            packet << static_cast<sf::Uint8>(BYE);
+            link.socket->send(packet);
+        }
+    }
+    for (Link& link : mLinks)
+    {
+        if (link.receiver.joinable())
+            link.receiver.join();
+    }
+}
+
+bool HaloNode::loadHosts(const std::string& filename, std::string& error)
+{
+    std::ifstream file(filename.c_str());
+    if (!file)
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+
+    mHosts.clear();
+    mPorts.clear();
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++)
+    {
+        std::istringstream words(line);
+        std::string address;
+        if (!(words >> address) || address.compare(0, 2, "//") == 0)
+            continue;
+
+        std::size_t colon = address.rfind(':');
+        int port = colon == std::string::npos ? 0 : std::atoi(address.c_str() + colon + 1);
+        if (colon == 0 || (colon != std::string::npos && (port <= 0 || port > 65535)))
+        {
+            std::ostringstream message;
+            message << filename << ":" << number << ": expected host or host:port";
+            error = message.str();
+            return false;
+        }
+        mHosts.push_back(address.substr(0, colon));
+        mPorts.push_back(port);
+    }
+    return true;
+}
+
+unsigned short HaloNode::getPort(int rank, unsigned short basePort) const
+{
+    if (rank < static_cast<int>(mPorts.size()) && mPorts[rank] != 0)
+        return mPorts[rank];
+    return basePort + rank;
+}
+
+bool HaloNode::start(const std::string& filename, unsigned short basePort, std::string& error)
+{
+    int nodes = mNodeColumns*mNodeRows;
+    if (mNodeColumns < 1 || mNodeRows < 1 || mRank < 0 || mRank >= nodes || mHalo < 1)
+    {
+        error = "Expected a rank within the nodes and a halo of at least one cell";
+        return false;
+    }
+    if (!Grid::readSize(filename, mBoardWidth, mBoardHeight))
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+    // Strips come from inside the neighbours' rectangles, so every rectangle has to be as wide and
+    // as high as the halo
+    if (mBoardWidth/mNodeColumns < mHalo || mBoardHeight/mNodeRows < mHalo)
+    {
+        std::ostringstream message;
+        message << "Can't split " << mBoardWidth << "x" << mBoardHeight << " cells into " << mNodeColumns << "x"
+                << mNodeRows << " rectangles with a halo of " << mHalo;
+        error = message.str();
+        return false;
+    }
+
+    int column = mRank % mNodeColumns;
+    int row = mRank / mNodeColumns;
+    mLeft = static_cast<long long>(column)*mBoardWidth/mNodeColumns;
+    mTop = static_cast<long long>(row)*mBoardHeight/mNodeRows;
+    mWidth = static_cast<long long>(column + 1)*mBoardWidth/mNodeColumns - mLeft;
+    mHeight = static_cast<long long>(row + 1)*mBoardHeight/mNodeRows - mTop;
+    mSpan = mWidth + 2*mHalo;
+    int spanHeight = mHeight + 2*mHalo;
+
+    Grid grid;
+    if (!grid.loadFromFile(filename, mLeft - mHalo, mTop - mHalo, mSpan, spanHeight))
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+    grid.flip(); // Commit the loaded cells
+
+    // Conductors on the outer edge of the halo are never stepped, so the neighbours of every cell
+    // stepped are in the buffers
+    mFront.assign(mSpan*spanHeight, NONE);
+    mInterior.clear();
+    mRim.clear();
+    for (int y = 0; y < spanHeight; y++)
+    {
+        for (int x = 0; x < mSpan; x++)
+        {
+            CellState cell = grid.getCell(x, y);
+            mFront[y*mSpan + x] = cell;
+            if (cell == NONE || x == 0 || y == 0 || x == mSpan - 1 || y == spanHeight - 1)
+                continue;
+            if (x > mHalo && y > mHalo && x < mHalo + mWidth - 1 && y < mHalo + mHeight - 1)
+                mInterior.push_back(y*mSpan + x);
+            else
+                mRim.push_back(y*mSpan + x);
+        }
+    }
+    mBack = mFront;
+    mCells = &mFront[0];
+
+    mLinks[LEFT].neighbour = row*mNodeColumns + (column + mNodeColumns - 1) % mNodeColumns;
+    mLinks[RIGHT].neighbour = row*mNodeColumns + (column + 1) % mNodeColumns;
+    mLinks[UP].neighbour = (row + mNodeRows - 1) % mNodeRows*mNodeColumns + column;
+    mLinks[DOWN].neighbour = (row + 1) % mNodeRows*mNodeColumns + column;
+
+    // Listen before connecting, so the neighbours' connections wait in the backlog until accepted
+    sf::TcpListener listener;
+    unsigned short port = getPort(mRank, basePort);
+    if (listener.listen(port) != sf::Socket::Done)
+    {
+        std::ostringstream message;
+        message << "Failed to listen on port " << port;
+        error = message.str();
+        return false;
+    }
+    if (!connect(RIGHT, basePort, error) || !connect(DOWN, basePort, error) || !accept(listener, error))
+        return false;
+    listener.close();
+
+    for (int direction = 0; direction < DIRECTION_COUNT; direction++)
+    {
+        if (mLinks[direction].socket)
+            mLinks[direction].receiver = std::thread(&HaloNode::listen, this, static_cast<Direction>(direction));
+    }
+    mRunning = true;
+    mExchanger = std::thread(&HaloNode::communicate, this);
+
+    return true;
+}
+
+bool HaloNode::connect(Direction direction, unsigned short basePort, std::string& error)
+{
+    Link& link = mLinks[direction];
+    if (link.neighbour == mRank)
+        return true;
+
+    std::string host = link.neighbour < static_cast<int>(mHosts.size()) ? mHosts[link.neighbour] : "";
+    sf::IpAddress address(host.empty() ? "127.0.0.1" : host.c_str());
+    unsigned short port = getPort(link.neighbour, basePort);
+
+    link.socket.reset(new sf::TcpSocket);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ConnectSeconds);
+    while (link.socket->connect(address, port) != sf::Socket::Done)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            std::ostringstream message;
+            message << "Node " << link.neighbour << " didn't answer on " << (host.empty() ? "127.0.0.1" : host) << ":" << port;
+            error = message.str();
+            link.socket.reset();
+            return false;
+        }
+        sf::sleep(sf::milliseconds(100));
+    }
+
+    sf::Packet hello;
+    hello << static_cast<sf::Uint8>(HELLO) << static_cast<sf::Uint32>(mRank) << static_cast<sf::Uint8>(direction)
+          << static_cast<sf::Uint32>(mBoardWidth) << static_cast<sf::Uint32>(mBoardHeight)
+          << static_cast<sf::Uint32>(mNodeColumns) << static_cast<sf::Uint32>(mNodeRows) << static_cast<sf::Uint32>(mHalo);
+    if (link.socket->send(hello) != sf::Socket::Done)
+    {
+        error = "Lost the connection to a neighbour while starting";
+        link.socket.reset();
+        return false;
+    }
+    return true;
+}
+
+bool HaloNode::accept(sf::TcpListener& listener, std::string& error)
+{
+    int expected = (mLinks[LEFT].neighbour != mRank) + (mLinks[UP].neighbour != mRank);
+
+    sf::SocketSelector selector;
+    selector.add(listener);
+    for (int accepted = 0; accepted < expected; accepted++)
+    {
+        std::unique_ptr<sf::TcpSocket> socket(new sf::TcpSocket);
+        if (!selector.wait(sf::seconds(ConnectSeconds)) || listener.accept(*socket) != sf::Socket::Done)
+        {
+            error = "The neighbours to the left and above didn't all connect";
+            return false;
+        }
+
+        sf::Packet hello;
+        sf::Uint8 message = 0;
+        sf::Uint32 rank = 0;
+        sf::Uint8 from = 0;
+        sf::Uint32 shape[5] = {};
+        if (socket->receive(hello) == sf::Socket::Done)
+            hello >> message >> rank >> from >> shape[0] >> shape[1] >> shape[2] >> shape[3] >> shape[4];
+
+        // The neighbour's connection to its right is this node's connection to its left
+        Direction direction = from == RIGHT ? LEFT : UP;
+        bool matches = hello && message == HELLO && (from == RIGHT || from == DOWN) &&
+                       static_cast<int>(rank) == mLinks[direction].neighbour && !mLinks[direction].socket;
+        if (!matches)
+        {
+            error = "Something other than a neighbour connected";
+            return false;
+        }
+        if (static_cast<int>(shape[0]) != mBoardWidth || static_cast<int>(shape[1]) != mBoardHeight ||
+            static_cast<int>(shape[2]) != mNodeColumns || static_cast<int>(shape[3]) != mNodeRows ||
+            static_cast<int>(shape[4]) != mHalo)
+        {
+            std::ostringstream text;
+            text << "Node " << rank << " has a different board, grid of nodes or halo";
+            error = text.str();
+            return false;
+        }
+        mLinks[direction].socket = std::move(socket);
+    }
+    return true;
+}
+
+void HaloNode::listen(Direction direction)
+{
+    Link& link = mLinks[direction];
+    sf::Packet packet;
+    while (true)
+    {
+        std::vector<unsigned char> message;
+        bool done = link.socket->receive(packet) != sf::Socket::Done || packet.getDataSize() == 0;
+        if (!done)
+        {
+            const unsigned char* data = static_cast<const unsigned char*>(packet.getData());
+            message.assign(data, data + packet.getDataSize());
+            done = message[0] == BYE;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (done)
+            link.closed = true;
+        else
+            link.inbox.push_back(std::move(message));
+        mChanged.notify_all();
+        if (done)
+            return;
+    }
+}
+
+bool HaloNode::send(Direction direction, const std::vector<unsigned char>& message, std::string& error)
+{
+    Link& link = mLinks[direction];
+    if (!link.socket)
+    {
+        // What this node sends to its right arrives from its left
+        static const Direction opposite[DIRECTION_COUNT] = {RIGHT, LEFT, DOWN, UP};
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLinks[opposite[direction]].inbox.push_back(message);
+        return true;
+    }
+
+    sf::Packet packet;
+    packet.append(&message[0], message.size());
+    if (link.socket->send(packet) != sf::Socket::Done)
+    {
+        std::ostringstream text;
+        text << "Lost the connection to node " << link.neighbour;
+        error = text.str();
+        return false;
+    }
+    return true;
+}
+
+bool HaloNode::receive(Direction direction, Message kind, std::vector<unsigned char>& message, std::string& error)
+{
+    Link& link = mLinks[direction];
+    std::unique_lock<std::mutex> lock(mMutex);
+    mChanged.wait(lock, [&link] {return !link.inbox.empty() || link.closed;});
+    if (link.inbox.empty())
+    {
+        std::ostringstream text;
+        text << "Node " << link.neighbour << " stopped";
+        error = text.str();
+        return false;
+    }
+    message.swap(link.inbox.front());
+    link.inbox.pop_front();
+    if (message[0] != kind)
+    {
+        std::ostringstream text;
+        text << "Node " << link.neighbour << " sent something unexpected";
+        error = text.str();
+        return false;
+    }
+    return true;
+}
+
+void HaloNode::communicate()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mChanged.wait(lock, [this] {return mExchangeCells || !mRunning;});
+        if (!mRunning)
+            return;
+
+        unsigned char* cells = mExchangeCells;
+        lock.unlock();
+        std::string error;
+        exchange(cells, error);
+        lock.lock();
+
+        mExchangeCells = 0;
+        mExchangeDone = true;
+        mExchangeError = error;
+        mChanged.notify_all();
+    }
+}
+
+bool HaloNode::exchange(unsigned char* cells, std::string& error)
+{
+    TraceScope trace("halo exchange", "io");
+
+    int k = mHalo;
+    std::vector<unsigned char> message;
+
+    // Columns of the rectangle's rows, to the left and right
+    copyOut(cells, k, k, k, mHeight, message);
+    if (!send(LEFT, message, error))
+        return false;
+    copyOut(cells, mWidth, k, k, mHeight, message);
+    if (!send(RIGHT, message, error))
+        return false;
+    if (!receive(RIGHT, STRIP, message, error) || !copyIn(cells, k + mWidth, k, k, mHeight, message, error) ||
+        !receive(LEFT, STRIP, message, error) || !copyIn(cells, 0, k, k, mHeight, message, error))
+        return false;
+
+    // Whole rows including the halo columns just filled, up and down
+    copyOut(cells, 0, k, mSpan, k, message);
+    if (!send(UP, message, error))
+        return false;
+    copyOut(cells, 0, mHeight, mSpan, k, message);
+    if (!send(DOWN, message, error))
+        return false;
+    return receive(DOWN, STRIP, message, error) && copyIn(cells, 0, k + mHeight, mSpan, k, message, error) &&
+           receive(UP, STRIP, message, error) && copyIn(cells, 0, 0, mSpan, k, message, error);
+}
+
+void HaloNode::copyOut(const unsigned char* cells, int left, int top, int width, int height,
+                       std::vector<unsigned char>& message) const
+{
+    message.resize(1 + width*height);
+    message[0] = STRIP;
+    for (int y = 0; y < height; y++)
+        std::copy(cells + (top + y)*mSpan + left, cells + (top + y)*mSpan + left + width, &message[1 + y*width]);
+}
+
+bool HaloNode::copyIn(unsigned char* cells, int left, int top, int width, int height,
+                      const std::vector<unsigned char>& message, std::string& error) const
+{
+    if (message.size() != static_cast<std::size_t>(1 + width*height))
+    {
+        error = "A neighbour sent a strip of the wrong size";
+        return false;
+    }
+    for (int y = 0; y < height; y++)
+        std::copy(&message[1 + y*width], &message[1 + y*width] + width, cells + (top + y)*mSpan + left);
+    return true;
+}
+
+void HaloNode::step(const std::vector<int>& cells, const unsigned char* current, unsigned char* next) const
+{
+    int w = mSpan;
+    for (int i : cells)
+    {
+        int neighbors = (current[i-w-1] == HEAD) + (current[i-w] == HEAD) + (current[i-w+1] == HEAD) +
+                        (current[i-1] == HEAD) + (current[i+1] == HEAD) +
+                        (current[i+w-1] == HEAD) + (current[i+w] == HEAD) + (current[i+w+1] == HEAD);
+        next[i] = Transition[current[i]][neighbors];
+    }
+}
+
+bool HaloNode::run(int generations, std::string& error)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    unsigned char* current = &mFront[0];
+    unsigned char* next = &mBack[0];
+    for (int done = 0; done < generations; done += mHalo)
+    {
+        // The halo is refilled while the cells which don't read it take their first step
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mExchangeCells = current;
+            mExchangeDone = false;
+            mChanged.notify_all();
+        }
+        {
+            TraceScope trace("interior", "sim");
+            step(mInterior, current, next);
+        }
+        {
+            TraceScope trace("wait", "io");
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, [this] {return mExchangeDone;});
+            if (!mExchangeError.empty())
+            {
+                error = mExchangeError;
+                return false;
+            }
+        }
+
+        // Each generation is only good one cell further in from the edge of the halo. Cells nearer
+        // are stepped anyway, and refilled before they matter.
+        TraceScope trace("rim", "sim");
+        step(mRim, current, next);
+        std::swap(current, next);
+        for (int generation = 1; generation < mHalo && done + generation < generations; generation++)
+        {
+            step(mInterior, current, next);
+            step(mRim, current, next);
+            std::swap(current, next);
+        }
+    }
+    mCells = current;
+    mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    mHeads = 0;
+    mTails = 0;
+    unsigned long long hash = 0;
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+        {
+            unsigned char cell = mCells[(mHalo + y)*mSpan + mHalo + x];
+            if (cell != HEAD && cell != TAIL)
+                continue;
+            mHeads += cell == HEAD;
+            mTails += cell == TAIL;
+            hash += mix(4ull*((mTop + y)*static_cast<unsigned long long>(mBoardWidth) + mLeft + x) + cell);
+        }
+    }
+
+    mTotals[0] = mHeads;
+    mTotals[1] = mTails;
+    mTotals[2] = hash;
+    return reduce(mTotals, error);
+}
+
+bool HaloNode::reduce(unsigned long long values[3], std::string& error)
+{
+    // Each node passes on what it last received, so after one step fewer than there are nodes in
+    // a ring, every node has seen every other node's values
+    const Direction to[2] = {RIGHT, DOWN};
+    const Direction from[2] = {LEFT, UP};
+    const int steps[2] = {mNodeColumns - 1, mNodeRows - 1};
+    for (int axis = 0; axis < 2; axis++)
+    {
+        unsigned long long carried[3] = {values[0], values[1], values[2]};
+        std::vector<unsigned char> message;
+        for (int i = 0; i < steps[axis]; i++)
+        {
+            message.assign(1, TOTALS);
+            for (unsigned long long value : carried)
+            {
+                for (int byte = 0; byte < 8; byte++)
+                    message.push_back(static_cast<unsigned char>(value >> 8*byte));
+            }
+            if (!send(to[axis], message, error) || !receive(from[axis], TOTALS, message, error))
+                return false;
+            if (message.size() != 1 + 3*8)
+            {
+                error = "A neighbour sent malformed totals";
+                return false;
+            }
+            for (int j = 0; j < 3; j++)
+            {
+                carried[j] = 0;
+                for (int byte = 0; byte < 8; byte++)
+                    carried[j] |= static_cast<unsigned long long>(message[1 + 8*j + byte]) << 8*byte;
+                values[j] += carried[j];
+            }
+        }
+    }
+    return true;
+}
+
+void HaloNode::printResults(std::ostream& out) const
+{
+    out << "Node " << mRank << " of " << mNodeColumns*mNodeRows << ": columns " << mLeft << " to "
+        << mLeft + mWidth - 1 << ", rows " << mTop << " to " << mTop + mHeight - 1 << ", halo " << mHalo << ", "
+        << mInterior.size() + mRim.size() << " conductors, heads " << mHeads << " tails " << mTails << "\n";
+    out << mBoardWidth << "x" << mBoardHeight << " board: heads " << mTotals[0] << " tails " << mTotals[1]
+        << "  electron hash " << std::hex << std::setw(16) << std::setfill('0') << mTotals[2] << std::setfill(' ')
+        << std::dec << "\n";
+}
@@ -0,0 +1,497 @@
+#include "InfiniteGrid.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "MemoryReport.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    const int ChunkShift = 6; // log2(CHUNK_SIZE)
+    const int ChunkMask = CHUNK_SIZE - 1;
+
+    /// \brief Scramble the bits of a value (the splitmix64 finaliser)
+    unsigned long long mix(unsigned long long value)
+    {
+        value = (value ^ (value >> 30))*0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27))*0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+}
+
+InfiniteGrid::Chunk* const InfiniteGrid::mTombstone = reinterpret_cast<InfiniteGrid::Chunk*>(1);
+
+InfiniteGrid::InfiniteGrid() : mSlots(16, Slot{0, 0, 0}), mUsed(0)
+{
+}
+
+InfiniteGrid::~InfiniteGrid()
+{
+    clear();
+}
+
+bool InfiniteGrid::loadFromFile(const std::string& filename)
+{
+    TraceScope trace("load", "io");
+
+    std::ifstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    int width = 0;
+    int height = 0;
+
+    // Same layout as Grid::loadFromFile()
+    file >> width >> height;
+    if (!file || width <= 0 || height <= 0)
+        return false;
+
+    clear();
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            char c = file.get();
+            if (c == '#')
+                setCell(x, y, WIRE);
+            else if (c == '@')
+                setCell(x, y, HEAD);
+            else if (c == '~')
+                setCell(x, y, TAIL);
+        }
+        file.get(); // skip the new line
+    }
+
+    return true;
+}
+
+bool InfiniteGrid::saveToFile(const std::string& filename) const
+{
+    TraceScope trace("save", "io");
+
+    std::ofstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    // Bounding box of the listed cells
+    int left = 0;
+    int top = 0;
+    int right = -1;
+    int bottom = -1;
+    bool empty = true;
+    for (const Chunk* chunk : mChunks)
+    {
+        for (const CellBlock* block = chunk->cells; block; block = block->next)
+        {
+            for (int i = 0; i < block->count; i++)
+            {
+                if (chunk->current[block->cells[i]] == NONE)
+                    continue;
+                int x = (chunk->cx << ChunkShift) + (block->cells[i] & ChunkMask);
+                int y = (chunk->cy << ChunkShift) + (block->cells[i] >> ChunkShift);
+                left = empty ? x : std::min(left, x);
+                top = empty ? y : std::min(top, y);
+                right = empty ? x : std::max(right, x);
+                bottom = empty ? y : std::max(bottom, y);
+                empty = false;
+            }
+        }
+    }
+
+    // Same layout as Grid::saveToFile(). A file needs at least one cell.
+    static const char symbols[] = {' ', '#', '@', '~'};
+    file << (empty ? 1 : right - left + 1) << " " << (empty ? 1 : bottom - top + 1);
+    for (int y = top; y <= std::max(top, bottom); y++)
+    {
+        for (int x = left; x <= std::max(left, right); x++)
+            file.put(symbols[getCell(x, y)]);
+        file.put('\n');
+    }
+
+    return static_cast<bool>(file);
+}
+
+void InfiniteGrid::update()
+{
+    TraceScope trace("update", "sim");
+
+    for (Chunk* chunk : mChunks)
+    {
+        // Only heads change anything, so a chunk with no electrons and no heads next door stays put
+        if (chunk->heads == 0 && chunk->tails == 0)
+        {
+            bool quiet = true;
+            for (int i = 0; i < 9 && quiet; i++)
+                quiet = !chunk->around[i] || chunk->around[i]->heads == 0;
+            if (quiet)
+                continue;
+        }
+
+        const unsigned char* cur = chunk->current;
+        for (CellBlock* block = chunk->cells; block; block = block->next)
+        {
+            for (int i = 0; i < block->count; i++)
+            {
+                int index = block->cells[i];
+                switch (cur[index])
+                {
+                    case WIRE:
+                    {
+                        int lx = index & ChunkMask;
+                        int ly = index >> ChunkShift;
+                        int neighbors = 0;
+                        if (lx > 0 && ly > 0 && lx < CHUNK_SIZE-1 && ly < CHUNK_SIZE-1)
+                        {
+                            neighbors = (cur[index-CHUNK_SIZE-1] == HEAD) + (cur[index-CHUNK_SIZE] == HEAD) +
+                                        (cur[index-CHUNK_SIZE+1] == HEAD) + (cur[index-1] == HEAD) + (cur[index+1] == HEAD) +
+                                        (cur[index+CHUNK_SIZE-1] == HEAD) + (cur[index+CHUNK_SIZE] == HEAD) +
+                                        (cur[index+CHUNK_SIZE+1] == HEAD);
+                        }
+                        else
+                        {
+                            for (int dy = -1; dy <= 1; dy++)
+                            {
+                                for (int dx = -1; dx <= 1; dx++)
+                                {
+                                    if (dx != 0 || dy != 0)
+                                        neighbors += cellAround(chunk, lx+dx, ly+dy) == HEAD;
+                                }
+                            }
+                        }
+
+                        if (neighbors == 1 || neighbors == 2)
+                            chunk->next[index] = HEAD; // becomes electron head
+
+                        break;
+                    }
+
+                    case HEAD: // electron head logic
+                        chunk->next[index] = TAIL;
+                        break;
+
+                    case TAIL: // electron tail logic
+                        chunk->next[index] = WIRE;
+                        break;
+                }
+            }
+        }
+    }
+}
+
+void InfiniteGrid::flip()
+{
+    TraceScope trace("flip", "sim");
+
+    std::size_t kept = 0;
+    for (Chunk* chunk : mChunks)
+    {
+        compactCells(chunk);
+        if (chunk->conductors == 0)
+            destroyChunk(chunk);
+        else
+            mChunks[kept++] = chunk;
+    }
+    mChunks.resize(kept);
+}
+
+CellState InfiniteGrid::getCell(int x, int y) const
+{
+    const Chunk* chunk = findChunk(x >> ChunkShift, y >> ChunkShift);
+    if (!chunk)
+        return NONE;
+
+    return static_cast<CellState>(chunk->current[((y & ChunkMask) << ChunkShift) | (x & ChunkMask)]);
+}
+
+void InfiniteGrid::setCell(int x, int y, CellState cell)
+{
+    Chunk* chunk = findChunk(x >> ChunkShift, y >> ChunkShift);
+    if (!chunk)
+    {
+        if (cell == NONE)
+            return;
+        chunk = createChunk(x >> ChunkShift, y >> ChunkShift);
+    }
+
+    int index = ((y & ChunkMask) << ChunkShift) | (x & ChunkMask);
+    if (chunk->current[index] == NONE && chunk->next[index] == NONE && cell != NONE)
+        addCell(chunk, index);
+    chunk->next[index] = cell;
+}
+
+PoolStats InfiniteGrid::getChunkStats()
+{
+    return Pool<Chunk>::getStats();
+}
+
+PoolStats InfiniteGrid::getCellListStats()
+{
+    return Pool<CellBlock>::getStats();
+}
+
+void InfiniteGrid::reportMemory(MemoryReport& report) const
+{
+    // Tombstones are wasted until the next rehash
+    report.add("chunk table", mUsed*sizeof(Slot), mSlots.capacity()*sizeof(Slot), (mUsed - mChunks.size())*sizeof(Slot));
+    report.add("chunk list", mChunks.size()*sizeof(Chunk*), mChunks.capacity()*sizeof(Chunk*));
+
+    PoolStats chunks = getChunkStats();
+    report.add("chunk pool", chunks.getLive()*sizeof(Chunk), chunks.slabs*Pool<Chunk>::getSlabBytes());
+
+    std::size_t listed = 0;
+    for (const Chunk* chunk : mChunks)
+    {
+        for (const CellBlock* block = chunk->cells; block; block = block->next)
+            listed += block->count;
+    }
+    PoolStats lists = getCellListStats();
+    report.add("cell list pool", listed*sizeof(unsigned short), lists.slabs*Pool<CellBlock>::getSlabBytes());
+}
+
+void InfiniteGrid::clear()
+{
+    for (Chunk* chunk : mChunks)
+    {
+        releaseCells(chunk->cells);
+        Pool<Chunk>::destroy(chunk);
+    }
+    mChunks.clear();
+    mSlots.assign(16, Slot{0, 0, 0});
+    mUsed = 0;
+}
+
+bool InfiniteGrid::hasHeads() const
+{
+    for (const Chunk* chunk : mChunks)
+    {
+        if (chunk->heads > 0)
+            return true;
+    }
+    return false;
+}
+
+unsigned long long InfiniteGrid::getStateHash() const
+{
+    unsigned long long hash = 0;
+    for (const Chunk* chunk : mChunks)
+    {
+        // Quiet chunks add nothing, and the chunk order doesn't matter to a sum
+        if (chunk->heads == 0 && chunk->tails == 0)
+            continue;
+
+        unsigned long long origin = mix((static_cast<unsigned long long>(static_cast<unsigned>(chunk->cy)) << 32) |
+                                        static_cast<unsigned>(chunk->cx));
+        for (const CellBlock* block = chunk->cells; block; block = block->next)
+        {
+            for (int i = 0; i < block->count; i++)
+            {
+                unsigned char cell = chunk->current[block->cells[i]];
+                if (cell == HEAD || cell == TAIL)
+                    hash += mix(origin + 4ull*block->cells[i] + cell);
+            }
+        }
+    }
+    return hash;
+}
+
+InfiniteGrid::Chunk* InfiniteGrid::findChunk(int cx, int cy) const
+{
+    std::size_t mask = mSlots.size() - 1;
+    for (std::size_t i = hash(cx, cy) & mask;; i = (i + 1) & mask)
+    {
+        const Slot& slot = mSlots[i];
+        if (!slot.chunk)
+            return 0;
+        if (slot.chunk != mTombstone && slot.cx == cx && slot.cy == cy)
+            return slot.chunk;
+    }
+}
+
+InfiniteGrid::Chunk* InfiniteGrid::createChunk(int cx, int cy)
+{
+    // Keep at most half the slots in use so probe sequences stay short
+    if (2*(mUsed + 1) > mSlots.size())
+        rehash(4*mChunks.size() > mSlots.size() ? 2*mSlots.size() : mSlots.size());
+
+    Chunk* chunk = Pool<Chunk>::create();
+    chunk->cx = cx;
+    chunk->cy = cy;
+    chunk->cells = 0;
+    chunk->lastBlock = 0;
+    std::fill(chunk->current, chunk->current + CHUNK_SIZE*CHUNK_SIZE, NONE);
+    std::fill(chunk->next, chunk->next + CHUNK_SIZE*CHUNK_SIZE, NONE);
+    chunk->conductors = 0;
+    chunk->heads = 0;
+    chunk->tails = 0;
+
+    // Link up with the neighbours both ways
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            Chunk* other = dx == 0 && dy == 0 ? chunk : findChunk(cx + dx, cy + dy);
+            chunk->around[(dy+1)*3 + dx+1] = other;
+            if (other)
+                other->around[(1-dy)*3 + 1-dx] = chunk;
+        }
+    }
+
+    std::size_t mask = mSlots.size() - 1;
+    std::size_t i = hash(cx, cy) & mask;
+    while (mSlots[i].chunk && mSlots[i].chunk != mTombstone)
+        i = (i + 1) & mask;
+    if (!mSlots[i].chunk)
+        mUsed++;
+    mSlots[i] = Slot{cx, cy, chunk};
+
+    mChunks.push_back(chunk);
+    return chunk;
+}
+
+void InfiniteGrid::destroyChunk(Chunk* chunk)
+{
+    for (int i = 0; i < 9; i++)
+    {
+        if (chunk->around[i] && i != 4)
+            chunk->around[i]->around[8-i] = 0;
+    }
+
+    std::size_t mask = mSlots.size() - 1;
+    for (std::size_t i = hash(chunk->cx, chunk->cy) & mask;; i = (i + 1) & mask)
+    {
+        if (mSlots[i].chunk == chunk)
+        {
+            mSlots[i].chunk = mTombstone;
+            break;
+        }
+    }
+
+    releaseCells(chunk->cells);
+
+    // The caller takes it out of mChunks
+    Pool<Chunk>::destroy(chunk);
+}
+
+void InfiniteGrid::rehash(std::size_t capacity)
+{
+    std::vector<Slot> old;
+    old.swap(mSlots);
+    mSlots.assign(capacity, Slot{0, 0, 0});
+    mUsed = 0;
+
+    std::size_t mask = capacity - 1;
+    for (const Slot& slot : old)
+    {
+        if (!slot.chunk || slot.chunk == mTombstone)
+            continue;
+
+        std::size_t i = hash(slot.cx, slot.cy) & mask;
+        while (mSlots[i].chunk)
+            i = (i + 1) & mask;
+        mSlots[i] = slot;
+        mUsed++;
+    }
+}
+
+void InfiniteGrid::addCell(Chunk* chunk, int index)
+{
+    CellBlock* block = chunk->lastBlock;
+    if (!block || block->count == CellBlockSize)
+    {
+        CellBlock* fresh = Pool<CellBlock>::create();
+        fresh->next = 0;
+        fresh->count = 0;
+        if (block)
+            block->next = fresh;
+        else
+            chunk->cells = fresh;
+        chunk->lastBlock = block = fresh;
+    }
+
+    block->cells[block->count++] = index;
+}
+
+void InfiniteGrid::releaseCells(CellBlock* block)
+{
+    while (block)
+    {
+        CellBlock* next = block->next;
+        Pool<CellBlock>::destroy(block);
+        block = next;
+    }
+}
+
+void InfiniteGrid::compactCells(Chunk* chunk)
+{
+    chunk->conductors = 0;
+    chunk->heads = 0;
+    chunk->tails = 0;
+    if (!chunk->cells)
+        return;
+
+    for (CellBlock* block = chunk->cells; block; block = block->next)
+    {
+        for (int i = 0; i < block->count; i++)
+            chunk->current[block->cells[i]] = chunk->next[block->cells[i]];
+    }
+
+    // Drop cells which went empty along with any cell listed twice, marking the ones kept with the
+    // top bit. The write position never overtakes the read position.
+    CellBlock* write = chunk->cells;
+    int written = 0;
+    for (CellBlock* block = chunk->cells; block; block = block->next)
+    {
+        for (int i = 0; i < block->count; i++)
+        {
+            int index = block->cells[i];
+            unsigned char& cell = chunk->current[index];
+            if (cell == NONE || cell & 0x80)
+                continue;
+
+            chunk->heads += cell == HEAD;
+            chunk->tails += cell == TAIL;
+            chunk->conductors++;
+            cell |= 0x80;
+
+            if (written == CellBlockSize)
+            {
+                write->count = written;
+                write = write->next;
+                written = 0;
+            }
+            write->cells[written++] = index;
+        }
+    }
+    write->count = written;
+
+    releaseCells(write->next);
+    write->next = 0;
+    chunk->lastBlock = write;
+
+    for (CellBlock* block = chunk->cells; block; block = block->next)
+    {
+        for (int i = 0; i < block->count; i++)
+            chunk->current[block->cells[i]] &= 0x7f;
+    }
+}
+
+std::size_t InfiniteGrid::hash(int cx, int cy)
+{
+    unsigned long long key = (static_cast<unsigned long long>(static_cast<unsigned>(cx)) << 32) | static_cast<unsigned>(cy);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return static_cast<std::size_t>(key);
+}
+
+unsigned char InfiniteGrid::cellAround(const Chunk* chunk, int lx, int ly)
+{
+    int ox = lx < 0 ? -1 : (lx >= CHUNK_SIZE ? 1 : 0);
+    int oy = ly < 0 ? -1 : (ly >= CHUNK_SIZE ? 1 : 0);
+    const Chunk* other = chunk->around[(oy+1)*3 + ox+1];
+    if (!other)
+        return NONE;
+
+    return other->current[((ly - oy*CHUNK_SIZE) << ChunkShift) | (lx - ox*CHUNK_SIZE)];
+}
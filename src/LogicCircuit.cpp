@@ -0,0 +1,872 @@
+#include "LogicCircuit.hpp"
+
+#include <algorithm>
+#include <functional>
+
+#include "Trace.hpp"
+
+namespace
+{
+    const int MaxTablePorts = 6; // Elements with more ports than this are always simulated cell by cell
+    const int MaxTableCells = 256;
+    const int MaxSettle = 256; // Generations an element may take to return to plain wire
+    const int MaxInhibitOffset = 6; // Timing window searched when looking for AND-NOT gates
+}
+
+LogicCircuit::LogicCircuit() : mWidth(0), mHeight(0), mTime(0)
+{
+}
+
+bool LogicCircuit::extract(const Grid& grid, std::string& error)
+{
+    TraceScope trace("extract", "logic");
+
+    if (grid.getWidth() < 3 || grid.getHeight() < 3)
+    {
+        error = "Circuits can only be extracted from boards of at least 3x3 cells";
+        return false;
+    }
+
+    mWidth = grid.getWidth();
+    mHeight = grid.getHeight();
+    mTime = 0;
+
+    mChains.clear();
+    mElements.clear();
+    mInitialHeads.clear();
+    mActive.clear();
+    mDying.clear();
+    mDeliveries = EventQueue();
+    mOutputs = EventQueue();
+
+    int count = mWidth*mHeight;
+    std::vector<unsigned char> state(count, NONE);
+    mConductor.assign(count, 0);
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+        {
+            state[y*mWidth + x] = grid.getCell(x, y);
+            mConductor[y*mWidth + x] = state[y*mWidth + x] != NONE;
+        }
+    }
+
+    // Compile the wire graph: the conductor neighbours of every conductor cell
+    std::vector<int> nbrStart(count + 1, 0);
+    std::vector<int> nbr;
+    for (int i = 0; i < count; i++)
+    {
+        nbrStart[i] = nbr.size();
+        if (!mConductor[i])
+            continue;
+
+        int x = i % mWidth;
+        int y = i / mWidth;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int j = grid.wrapY(y+dy)*mWidth + grid.wrapX(x+dx);
+                if (j == i || !mConductor[j])
+                    continue;
+                if (std::find(nbr.begin() + nbrStart[i], nbr.end(), j) == nbr.end())
+                    nbr.push_back(j);
+            }
+        }
+    }
+    nbrStart[count] = nbr.size();
+
+    auto degree = [&](int i) {return nbrStart[i+1] - nbrStart[i];};
+    auto adjacent = [&](int a, int b) {
+        return std::find(nbr.begin() + nbrStart[a], nbr.begin() + nbrStart[a+1], b) != nbr.begin() + nbrStart[a+1];
+    };
+
+    // Chain cells have at most two neighbours, which mustn't touch each other
+    std::vector<unsigned char> chainCell(count, 0);
+    for (int i = 0; i < count; i++)
+    {
+        if (!mConductor[i])
+            continue;
+        int d = degree(i);
+        chainCell[i] = d <= 1 || (d == 2 && !adjacent(nbr[nbrStart[i]], nbr[nbrStart[i]+1]));
+    }
+
+    // Walk the chains from their ends. Junction cells at each end are kept until the elements exist.
+    std::vector<int> chainOf(count, -1);
+    std::vector<int> endJunction; // Two per chain
+    for (int i = 0; i < count; i++)
+    {
+        if (!chainCell[i] || chainOf[i] >= 0)
+            continue;
+
+        int chainNbrs = 0;
+        for (int k = nbrStart[i]; k < nbrStart[i+1]; k++)
+            chainNbrs += chainCell[nbr[k]];
+        if (chainNbrs == 2)
+            continue; // Not an end
+
+        Chain chain;
+        int id = mChains.size();
+        int prev = -1;
+        int cur = i;
+        while (cur >= 0)
+        {
+            chain.cells.push_back(cur);
+            chainOf[cur] = id;
+
+            int next = -1;
+            for (int k = nbrStart[cur]; k < nbrStart[cur+1]; k++)
+            {
+                int j = nbr[k];
+                if (chainCell[j] && j != prev && chainOf[j] < 0)
+                    next = j;
+            }
+            prev = cur;
+            cur = next;
+        }
+
+        int junctions[2] = {-1, -1};
+        int found = 0;
+        int ends[2] = {chain.cells.front(), chain.cells.back()};
+        for (int e = 0; e < 2; e++)
+        {
+            if (e == 1 && chain.cells.size() == 1)
+                break;
+            for (int k = nbrStart[ends[e]]; k < nbrStart[ends[e]+1]; k++)
+            {
+                if (!chainCell[nbr[k]] && found < 2)
+                    junctions[chain.cells.size() == 1 ? found++ : e] = nbr[k];
+            }
+        }
+
+        mChains.push_back(chain);
+        endJunction.push_back(junctions[0]);
+        endJunction.push_back(junctions[1]);
+    }
+
+    // Closed rings of chain cells have no ends and are simulated as elements
+    for (int i = 0; i < count; i++)
+    {
+        if (chainCell[i] && chainOf[i] < 0)
+            chainCell[i] = 0;
+    }
+
+    // Short chains between junctions are folded into the elements around them
+    std::vector<Chain> chains;
+    std::vector<int> junctions;
+    for (std::size_t c = 0; c < mChains.size(); c++)
+    {
+        bool attached = endJunction[2*c] >= 0 || endJunction[2*c+1] >= 0;
+        if (attached && mChains[c].cells.size() < 3)
+        {
+            for (int cell : mChains[c].cells)
+                chainCell[cell] = 0;
+            continue;
+        }
+        chains.push_back(mChains[c]);
+        junctions.push_back(endJunction[2*c]);
+        junctions.push_back(endJunction[2*c+1]);
+    }
+    mChains.swap(chains);
+
+    // Connected junction cells form the elements
+    mOwner.assign(count, -1);
+    std::vector<int> stack;
+    for (int i = 0; i < count; i++)
+    {
+        if (!mConductor[i] || chainCell[i] || mOwner[i] >= 0)
+            continue;
+
+        int id = mElements.size();
+        mElements.push_back(Element());
+        Element& element = mElements.back();
+
+        mOwner[i] = id;
+        stack.push_back(i);
+        while (!stack.empty())
+        {
+            int cell = stack.back();
+            stack.pop_back();
+            element.cells.push_back(cell);
+
+            for (int k = nbrStart[cell]; k < nbrStart[cell+1]; k++)
+            {
+                int j = nbr[k];
+                if (!chainCell[j] && mOwner[j] < 0)
+                {
+                    mOwner[j] = id;
+                    stack.push_back(j);
+                }
+            }
+        }
+    }
+
+    // Attach the chains. The end cell of a chain becomes a port of the element it touches.
+    for (std::size_t c = 0; c < mChains.size(); c++)
+    {
+        Chain& chain = mChains[c];
+        for (int e = 0; e < 2; e++)
+        {
+            chain.element[e] = -1;
+            chain.port[e] = -1;
+            chain.lastArrival[e] = -3;
+
+            int junction = junctions[2*c+e];
+            if (junction < 0)
+                continue;
+
+            Element& element = mElements[mOwner[junction]];
+            int cell = e == 0 ? chain.cells.front() : chain.cells.back();
+            chain.element[e] = mOwner[junction];
+            chain.port[e] = element.portCell.size();
+            element.portCell.push_back(element.cells.size());
+            element.portChain.push_back(c);
+            element.portEnd.push_back(e);
+            element.cells.push_back(cell);
+            mOwner[cell] = chain.element[e];
+        }
+    }
+
+    // Local adjacency and initial state of each element
+    std::vector<int> local(count, -1);
+    for (std::size_t id = 0; id < mElements.size(); id++)
+    {
+        Element& element = mElements[id];
+        for (std::size_t k = 0; k < element.cells.size(); k++)
+            local[element.cells[k]] = k;
+
+        element.adjStart.assign(1, 0);
+        for (int cell : element.cells)
+        {
+            for (int k = nbrStart[cell]; k < nbrStart[cell+1]; k++)
+            {
+                if (mOwner[nbr[k]] == static_cast<int>(id))
+                    element.adj.push_back(local[nbr[k]]);
+            }
+            element.adjStart.push_back(element.adj.size());
+        }
+
+        element.active = false;
+        element.cur.resize(element.cells.size());
+        element.next.resize(element.cells.size());
+        for (std::size_t k = 0; k < element.cells.size(); k++)
+        {
+            element.cur[k] = state[element.cells[k]];
+            if (element.cur[k] != WIRE)
+                element.active = true;
+        }
+        element.quietFrom = 0;
+        element.batchTime = -1;
+        element.batchMask = 0;
+        element.serial = 0;
+
+        if (element.active)
+            mActive.push_back(id);
+    }
+
+    for (std::size_t id = 0; id < mElements.size(); id++)
+        classify(mElements[id]);
+
+    // Electrons already on the chains. A head moves towards each neighbouring plain wire.
+    for (std::size_t c = 0; c < mChains.size(); c++)
+    {
+        Chain& chain = mChains[c];
+        int length = chain.cells.size();
+
+        std::vector<int> forward; // Positions of heads moving towards cL-1
+        std::vector<DyingPulse> dying;
+        for (int i = 0; i < length; i++)
+        {
+            if (state[chain.cells[i]] != HEAD)
+                continue;
+            if (mOwner[chain.cells[i]] < 0)
+                mInitialHeads.push_back(chain.cells[i]);
+
+            // Heads moving towards c0 meet the nearest head moving the other way first
+            if (i > 0 && state[chain.cells[i-1]] == WIRE)
+            {
+                if (!forward.empty())
+                {
+                    int gap = i - forward.back();
+                    long long meet = (gap - 1)/2;
+                    dying.push_back(DyingPulse{static_cast<int>(c), 0, -forward.back(), meet, gap - 2*static_cast<int>(meet)});
+                    dying.push_back(DyingPulse{static_cast<int>(c), 1, -(length-1-i), meet, gap - 2*static_cast<int>(meet)});
+                    forward.pop_back();
+                }
+                else
+                    chain.pulses[1].push_back(-(length-1-i));
+            }
+            if (i < length-1 && state[chain.cells[i+1]] == WIRE)
+                forward.push_back(i);
+        }
+        for (int i : forward)
+            chain.pulses[0].push_back(-i);
+
+        std::sort(chain.pulses[0].begin(), chain.pulses[0].end());
+        std::sort(chain.pulses[1].begin(), chain.pulses[1].end());
+        for (int d = 0; d < 2; d++)
+        {
+            for (long long entry : chain.pulses[d])
+                mDeliveries.push(Event{entry + length - 1, static_cast<int>(c), d, entry});
+        }
+        mDying.insert(mDying.end(), dying.begin(), dying.end());
+    }
+
+    return true;
+}
+
+void LogicCircuit::classify(Element& element)
+{
+    int ports = element.portCell.size();
+    int id = &element - &mElements[0];
+
+    element.kind = GENERIC;
+    element.period = 0;
+    element.tabled = false;
+
+    if (ports == 0 || ports > MaxTablePorts || static_cast<int>(element.cells.size()) > MaxTableCells)
+        return;
+
+    // Tabulate the response to every combination of simultaneous inputs
+    element.table.assign(1u << ports, std::vector<Response>());
+    element.settle.assign(1u << ports, 0);
+    std::vector<int> injectTime(ports);
+    for (unsigned mask = 1; mask < (1u << ports); mask++)
+    {
+        for (int p = 0; p < ports; p++)
+            injectTime[p] = (mask >> p) & 1 ? 0 : -1;
+        if (!probe(element, injectTime, element.table[mask], element.settle[mask]))
+        {
+            element.table.clear();
+            element.settle.clear();
+            return;
+        }
+    }
+    element.tabled = true;
+
+    // Which ports each single input reaches, and how fast
+    std::vector<unsigned> reaches(ports, 0);
+    std::vector<std::vector<int> > latency(ports, std::vector<int>(ports, -1));
+    for (int p = 0; p < ports; p++)
+    {
+        for (const Response& r : element.table[1u << p])
+        {
+            if (r.port == p)
+                continue;
+            reaches[p] |= 1u << r.port;
+            if (latency[p][r.port] < 0)
+                latency[p][r.port] = r.dt;
+        }
+    }
+
+    // A chain leaving and re-entering the element closes a clock loop
+    for (int p = 0; p < ports; p++)
+    {
+        const Chain& chain = mChains[element.portChain[p]];
+        if (element.portEnd[p] != 0 || chain.element[0] != id || chain.element[1] != id)
+            continue;
+
+        int length = chain.cells.size();
+        int out = chain.port[0];
+        int in = chain.port[1];
+        if (latency[in][out] < 0)
+            std::swap(in, out);
+        if (latency[in][out] >= 0)
+        {
+            element.kind = CLOCK;
+            element.period = length - 1 + latency[in][out];
+            return;
+        }
+    }
+
+    unsigned all = (1u << ports) - 1;
+    if (ports == 2)
+    {
+        if (reaches[0] && reaches[1])
+            element.kind = PASSIVE;
+        else if (reaches[0] || reaches[1])
+            element.kind = DIODE;
+        return;
+    }
+
+    bool fanout = ports >= 3; // Not a stub with nothing to conduct to
+    for (int p = 0; p < ports; p++)
+        fanout = fanout && reaches[p] == (all & ~(1u << p));
+    if (fanout)
+    {
+        element.kind = FANOUT;
+        return;
+    }
+
+    if (ports != 3)
+        return;
+
+    // Two inputs which only reach a third port. Going by the forward truth table from the inputs to
+    // the output: what the output conducts back into the inputs is stopped by the diodes in front
+    // of them, so it is ignored.
+    for (int out = 0; out < 3 && element.kind == GENERIC; out++)
+    {
+        int a = (out + 1) % 3;
+        int b = (out + 2) % 3;
+        if ((reaches[a] | reaches[b]) & ~(1u << out))
+            continue;
+        if (!reaches[a])
+            std::swap(a, b);
+        if (!reaches[a])
+            continue;
+
+        std::vector<Response> fires;
+        int settle = 0;
+        injectTime.assign(3, -1);
+        if (reaches[b])
+        {
+            // Both inputs timed so that their outputs coincide
+            injectTime[a] = std::max(0, latency[b][out] - latency[a][out]);
+            injectTime[b] = injectTime[a] + latency[a][out] - latency[b][out];
+            if (!probe(element, injectTime, fires, settle))
+                return;
+
+            bool fired = false;
+            bool together = false;
+            for (const Response& r : fires)
+            {
+                if (r.port != out)
+                    continue;
+                fired = true;
+                together = together || r.dt == injectTime[a] + latency[a][out];
+            }
+            if (!fired)
+                element.kind = XOR_GATE;
+            else if (together)
+                element.kind = OR_GATE;
+        }
+        else
+        {
+            // The second input never gets through, but may still block the first
+            for (int offset = -MaxInhibitOffset; offset <= MaxInhibitOffset; offset++)
+            {
+                injectTime[a] = std::max(0, -offset);
+                injectTime[b] = injectTime[a] + offset;
+                if (!probe(element, injectTime, fires, settle))
+                    return;
+
+                bool fired = false;
+                for (const Response& r : fires)
+                    fired = fired || r.port == out;
+                if (!fired)
+                {
+                    element.kind = ANDNOT_GATE;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+bool LogicCircuit::probe(const Element& element, const std::vector<int>& injectTime, std::vector<Response>& fires,
+                         int& settle) const
+{
+    int ports = element.portCell.size();
+    int lastInject = 0;
+    for (int p = 0; p < ports; p++)
+        lastInject = std::max(lastInject, injectTime[p]);
+
+    std::vector<unsigned char> cur(element.cells.size(), WIRE);
+    std::vector<unsigned char> next(element.cells.size());
+    fires.clear();
+
+    for (int t = 0; t <= MaxSettle; t++)
+    {
+        stepCells(element, cur, next);
+        for (int p = 0; p < ports; p++)
+        {
+            int cell = element.portCell[p];
+            if (cur[cell] == WIRE && next[cell] == HEAD)
+                fires.push_back(Response{t, p});
+        }
+        for (int p = 0; p < ports; p++)
+        {
+            int cell = element.portCell[p];
+            if (injectTime[p] == t && cur[cell] == WIRE)
+                next[cell] = HEAD;
+        }
+        cur.swap(next);
+
+        if (t >= lastInject && std::count(cur.begin(), cur.end(), WIRE) == static_cast<int>(cur.size()))
+        {
+            settle = t;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void LogicCircuit::stepCells(const Element& element, const std::vector<unsigned char>& cur,
+                             std::vector<unsigned char>& next)
+{
+    for (std::size_t k = 0; k < cur.size(); k++)
+    {
+        switch (cur[k])
+        {
+            case WIRE:
+            {
+                int neighbors = 0;
+                for (int a = element.adjStart[k]; a < element.adjStart[k+1]; a++)
+                    neighbors += cur[element.adj[a]] == HEAD;
+                next[k] = neighbors == 1 || neighbors == 2 ? HEAD : WIRE;
+                break;
+            }
+            case HEAD:
+                next[k] = TAIL;
+                break;
+            default:
+                next[k] = WIRE;
+                break;
+        }
+    }
+}
+
+void LogicCircuit::replay(const Element& element, long long time, std::vector<unsigned char>& cells) const
+{
+    cells.assign(element.cells.size(), WIRE);
+    if (time >= element.quietFrom || element.batchTime < 0)
+        return;
+
+    for (std::size_t p = 0; p < element.portCell.size(); p++)
+    {
+        if ((element.batchMask >> p) & 1)
+            cells[element.portCell[p]] = HEAD;
+    }
+
+    std::vector<unsigned char> next(cells.size());
+    for (long long t = element.batchTime; t < time; t++)
+    {
+        stepCells(element, cells, next);
+        cells.swap(next);
+    }
+}
+
+void LogicCircuit::step()
+{
+    TraceScope trace("step", "logic");
+
+    long long now = mTime + 1;
+
+    // Elements simulated cell by cell
+    std::vector<std::pair<int, int> > emissions;
+    for (int id : mActive)
+    {
+        Element& element = mElements[id];
+        stepCells(element, element.cur, element.next);
+        for (std::size_t p = 0; p < element.portCell.size(); p++)
+        {
+            int cell = element.portCell[p];
+            if (element.cur[cell] == WIRE && element.next[cell] == HEAD)
+                emissions.push_back(std::make_pair(id, static_cast<int>(p)));
+        }
+    }
+
+    // Elements driven by their tables
+    while (!mOutputs.empty() && mOutputs.top().time <= now)
+    {
+        Event event = mOutputs.top();
+        mOutputs.pop();
+        if (event.tag == mElements[event.target].serial)
+            emissions.push_back(std::make_pair(event.target, event.index));
+    }
+
+    for (const std::pair<int, int>& emission : emissions)
+    {
+        const Element& element = mElements[emission.first];
+        emitPulse(element.portChain[emission.second], element.portEnd[emission.second], now);
+    }
+
+    // Pulses reaching the end of their chain
+    std::vector<std::pair<int, int> > arrivals;
+    while (!mDeliveries.empty() && mDeliveries.top().time <= now)
+    {
+        Event event = mDeliveries.top();
+        mDeliveries.pop();
+
+        Chain& chain = mChains[event.target];
+        std::deque<long long>& pulses = chain.pulses[event.index];
+        if (pulses.empty() || pulses.front() != event.tag)
+            continue; // Annihilated on the way
+        pulses.pop_front();
+        chain.lastArrival[event.index] = now;
+
+        int end = 1 - event.index;
+        if (chain.element[end] >= 0)
+            arrivals.push_back(std::make_pair(chain.element[end], chain.port[end]));
+    }
+
+    std::sort(arrivals.begin(), arrivals.end());
+    for (std::size_t i = 0; i < arrivals.size();)
+    {
+        int id = arrivals[i].first;
+        std::size_t first = i;
+        for (; i < arrivals.size() && arrivals[i].first == id; i++);
+
+        Element& element = mElements[id];
+        if (!element.active)
+        {
+            if (element.tabled && now - 1 >= element.quietFrom)
+            {
+                unsigned mask = 0;
+                for (std::size_t k = first; k < i; k++)
+                    mask |= 1u << arrivals[k].second;
+                runTable(id, mask, now);
+                continue;
+            }
+            wake(id, now);
+        }
+
+        for (std::size_t k = first; k < i; k++)
+        {
+            int cell = element.portCell[arrivals[k].second];
+            if (element.cur[cell] == WIRE)
+                element.next[cell] = HEAD;
+        }
+    }
+
+    // Commit the elements simulated cell by cell, and retire the ones which went quiet
+    std::size_t kept = 0;
+    for (int id : mActive)
+    {
+        Element& element = mElements[id];
+        element.cur.swap(element.next);
+        if (std::count(element.cur.begin(), element.cur.end(), WIRE) == static_cast<int>(element.cur.size()))
+        {
+            element.active = false;
+            element.quietFrom = now;
+        }
+        else
+            mActive[kept++] = id;
+    }
+    mActive.resize(kept);
+
+    std::size_t alive = 0;
+    for (const DyingPulse& pulse : mDying)
+    {
+        if (pulse.meet + 2 >= now)
+            mDying[alive++] = pulse;
+    }
+    mDying.resize(alive);
+
+    mTime = now;
+}
+
+void LogicCircuit::emitPulse(int id, int dir, long long now)
+{
+    Chain& chain = mChains[id];
+    int length = chain.cells.size();
+    std::deque<long long>& opposite = chain.pulses[1-dir];
+
+    if (!opposite.empty())
+    {
+        long long arrival = opposite.front() + length - 1;
+        if (arrival == now)
+            return; // Blocked by the tail of the pulse arriving here
+
+        // Head-on collision: both pulses die when their heads are one or two cells apart
+        long long gap = arrival - now;
+        long long meet = now + (gap - 1)/2;
+        int last = gap - 2*(meet - now);
+        mDying.push_back(DyingPulse{id, 1-dir, opposite.front(), meet, last});
+        mDying.push_back(DyingPulse{id, dir, now, meet, last});
+        opposite.pop_front();
+        return;
+    }
+
+    chain.pulses[dir].push_back(now);
+    mDeliveries.push(Event{now + length - 1, id, dir, now});
+}
+
+void LogicCircuit::runTable(int id, unsigned mask, long long now)
+{
+    Element& element = mElements[id];
+    for (const Response& r : element.table[mask])
+        mOutputs.push(Event{now + r.dt, id, r.port, element.serial});
+    element.batchTime = now;
+    element.batchMask = mask;
+    element.quietFrom = now + element.settle[mask];
+}
+
+void LogicCircuit::wake(int id, long long now)
+{
+    Element& element = mElements[id];
+    if (now - 1 >= element.quietFrom)
+        element.cur.assign(element.cells.size(), WIRE);
+    else
+    {
+        // Still settling from the last batch: switch to the cells for an exact answer
+        element.serial++;
+        replay(element, now - 1, element.cur);
+    }
+
+    stepCells(element, element.cur, element.next);
+    element.active = true;
+    mActive.push_back(id);
+}
+
+void LogicCircuit::materialize(std::vector<CellState>& cells) const
+{
+    cells.assign(mWidth*mHeight, NONE);
+    for (std::size_t i = 0; i < cells.size(); i++)
+    {
+        if (mConductor[i])
+            cells[i] = WIRE;
+    }
+
+    if (mTime == 1)
+    {
+        for (int cell : mInitialHeads)
+            cells[cell] = TAIL;
+    }
+
+    for (const Chain& chain : mChains)
+    {
+        int length = chain.cells.size();
+        auto put = [&](int dir, long long pos, CellState s) {
+            if (pos < 0 || pos >= length)
+                return;
+            int index = dir == 0 ? pos : length-1-pos;
+            if ((index == 0 && chain.element[0] >= 0) || (index == length-1 && chain.element[1] >= 0))
+                return; // Owned by the element
+            cells[chain.cells[index]] = s;
+        };
+
+        for (int d = 0; d < 2; d++)
+        {
+            for (long long entry : chain.pulses[d])
+            {
+                put(d, mTime - entry, HEAD);
+                put(d, mTime - entry - 1, TAIL);
+            }
+            if (chain.lastArrival[d] == mTime)
+            {
+                put(d, length-1, HEAD);
+                put(d, length-2, TAIL);
+            }
+            else if (chain.lastArrival[d] == mTime-1)
+                put(d, length-1, TAIL);
+        }
+    }
+
+    for (const DyingPulse& pulse : mDying)
+    {
+        const Chain& chain = mChains[pulse.chain];
+        int length = chain.cells.size();
+        auto put = [&](long long pos, CellState s) {
+            if (pos < 0 || pos >= length)
+                return;
+            int index = pulse.dir == 0 ? pos : length-1-pos;
+            if ((index == 0 && chain.element[0] >= 0) || (index == length-1 && chain.element[1] >= 0))
+                return;
+            cells[chain.cells[index]] = s;
+        };
+
+        long long met = pulse.meet - pulse.entry;
+        if (mTime <= pulse.meet)
+        {
+            put(mTime - pulse.entry, HEAD);
+            put(mTime - pulse.entry - 1, TAIL);
+        }
+        else if (mTime == pulse.meet + 1)
+        {
+            put(met, TAIL);
+            if (pulse.gap == 2 && pulse.dir == 0)
+                put(met + 1, HEAD); // The cell between the heads fires once
+        }
+        else if (mTime == pulse.meet + 2 && pulse.gap == 2 && pulse.dir == 0)
+            put(met + 1, TAIL);
+    }
+
+    std::vector<unsigned char> replayed;
+    for (const Element& element : mElements)
+    {
+        const std::vector<unsigned char>* state = &element.cur;
+        if (!element.active)
+        {
+            replay(element, mTime, replayed);
+            state = &replayed;
+        }
+        for (std::size_t k = 0; k < element.cells.size(); k++)
+            cells[element.cells[k]] = static_cast<CellState>((*state)[k]);
+    }
+}
+
+int LogicCircuit::validate(const Grid& reference) const
+{
+    std::vector<CellState> cells;
+    materialize(cells);
+
+    int mismatches = 0;
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+        {
+            if (cells[y*mWidth + x] != reference.getCell(x, y))
+                mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+int LogicCircuit::getElementCount(ElementKind kind) const
+{
+    int count = 0;
+    for (const Element& element : mElements)
+        count += element.kind == kind;
+    return count;
+}
+
+void LogicCircuit::printSummary(std::ostream& out) const
+{
+    std::size_t chainCells = 0;
+    std::size_t pulses = 0;
+    for (const Chain& chain : mChains)
+    {
+        chainCells += chain.cells.size();
+        pulses += chain.pulses[0].size() + chain.pulses[1].size();
+    }
+
+    int tabled = 0;
+    std::size_t elementCells = 0;
+    for (const Element& element : mElements)
+    {
+        tabled += element.tabled;
+        elementCells += element.cells.size();
+    }
+
+    out << "Chains: " << mChains.size() << " (" << chainCells << " cells, " << pulses << " pulses)\n";
+    out << "Elements: " << mElements.size() << " (" << elementCells << " cells, " << tabled << " as logic, "
+        << mElements.size() - tabled << " cell by cell)\n";
+    for (int kind = 0; kind < ELEMENT_KIND_COUNT; kind++)
+        out << "  " << getKindName(static_cast<ElementKind>(kind)) << ": " << getElementCount(static_cast<ElementKind>(kind)) << "\n";
+
+    int clocks = 0;
+    for (const Element& element : mElements)
+    {
+        if (element.kind == CLOCK && clocks++ < 8)
+            out << "  clock with period " << element.period << "\n";
+    }
+}
+
+const char* LogicCircuit::getKindName(ElementKind kind)
+{
+    switch (kind)
+    {
+        case GENERIC: return "generic";
+        case PASSIVE: return "passive";
+        case DIODE: return "diode";
+        case FANOUT: return "fan-out";
+        case OR_GATE: return "or";
+        case XOR_GATE: return "xor";
+        case ANDNOT_GATE: return "and-not";
+        case CLOCK: return "clock";
+        default: return "?";
+    }
+}
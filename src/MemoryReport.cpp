@@ -0,0 +1,58 @@
+#include "MemoryReport.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+    std::string formatBytes(std::size_t bytes)
+    {
+        std::ostringstream text;
+        if (bytes < 1024)
+            text << bytes << " B";
+        else if (bytes < 1024*1024)
+            text << std::fixed << std::setprecision(1) << bytes/1024.0 << " KB";
+        else
+            text << std::fixed << std::setprecision(1) << bytes/(1024.0*1024.0) << " MB";
+        return text.str();
+    }
+}
+
+void MemoryReport::add(const std::string& name, std::size_t used, std::size_t reserved, std::size_t wasted)
+{
+    Item item = {name, used, reserved, wasted};
+    mItems.push_back(item);
+}
+
+std::size_t MemoryReport::getTotalReserved() const
+{
+    std::size_t total = 0;
+    for (const Item& item : mItems)
+        total += item.reserved;
+    return total;
+}
+
+void MemoryReport::print(std::ostream& out) const
+{
+    for (const Item& item : mItems)
+    {
+        out << std::left << std::setw(22) << item.name << std::right << std::setw(10) << formatBytes(item.used)
+            << " used " << std::setw(10) << formatBytes(item.reserved) << " reserved";
+        if (item.wasted > 0)
+            out << "  (" << formatBytes(item.wasted) << " wasted)";
+        out << "\n";
+    }
+    out << std::left << std::setw(22) << "total" << std::right << std::setw(10) << "" << "      "
+        << std::setw(10) << formatBytes(getTotalReserved()) << " reserved\n";
+}
+
+void MemoryReport::printLine(std::ostream& out) const
+{
+    out << "memory " << formatBytes(getTotalReserved());
+    for (const Item& item : mItems)
+    {
+        out << " | " << item.name << " " << formatBytes(item.used) << "/" << formatBytes(item.reserved);
+        if (item.wasted > 0)
+            out << " (" << formatBytes(item.wasted) << " wasted)";
+    }
+}
@@ -0,0 +1,194 @@
+#include "NumaTopology.hpp"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    const char* const NodeDirectory = "/sys/devices/system/node";
+    const std::size_t PageBatch = 1024; // Pages located per system call
+
+    /// \brief Parse a sysfs CPU list such as "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        const char* text = list.c_str();
+        while (*text)
+        {
+            char* end;
+            long first = std::strtol(text, &end, 10);
+            if (end == text)
+                break;
+            long last = first;
+            if (*end == '-')
+            {
+                text = end + 1;
+                last = std::strtol(text, &end, 10);
+            }
+            for (long cpu = first; cpu <= last; cpu++)
+                cpus.push_back(static_cast<int>(cpu));
+            text = *end == ',' ? end + 1 : end;
+        }
+        return cpus;
+    }
+}
+
+NumaTopology::NumaTopology() : mNodeCount(1)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    std::vector<std::pair<int, int>> cpus; // Node and number
+    std::vector<bool> placed(CPU_SETSIZE, false);
+    if (DIR* directory = opendir(NodeDirectory))
+    {
+        while (dirent* entry = readdir(directory))
+        {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos)
+                continue;
+            int node = std::atoi(name.c_str() + 4);
+
+            std::ifstream file((std::string(NodeDirectory) + "/" + name + "/cpulist").c_str());
+            std::string list;
+            std::getline(file, list);
+            for (int cpu : parseCpuList(list))
+            {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !placed[cpu])
+                {
+                    cpus.push_back(std::make_pair(node, cpu));
+                    placed[cpu] = true;
+                }
+            }
+        }
+        closedir(directory);
+    }
+
+    // Without NUMA support in the kernel there is no node directory
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && !placed[cpu])
+            cpus.push_back(std::make_pair(0, cpu));
+    }
+    std::sort(cpus.begin(), cpus.end());
+
+    mNodeCount = 0;
+    for (std::size_t i = 0; i < cpus.size(); i++)
+    {
+        mCpus.push_back(cpus[i].second);
+        mNodes.push_back(cpus[i].first);
+        if (i == 0 || cpus[i].first != cpus[i-1].first)
+            mNodeCount++;
+    }
+    mNodeCount = std::max(1, mNodeCount);
+}
+
+bool NumaTopology::pinThread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool NumaTopology::countPages(const void* data, std::size_t size, std::vector<std::size_t>& pages,
+                              std::size_t& untouched)
+{
+    pages.clear();
+    untouched = 0;
+    if (size == 0)
+        return true;
+
+    // move_pages() without target nodes only reports where each page is
+    std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    const char* first = static_cast<const char*>(data) - reinterpret_cast<std::size_t>(data) % pageSize;
+    const char* end = static_cast<const char*>(data) + size;
+    std::vector<void*> addresses;
+    std::vector<int> status(PageBatch);
+    for (const char* page = first; page < end; )
+    {
+        addresses.clear();
+        for (; page < end && addresses.size() < PageBatch; page += pageSize)
+            addresses.push_back(const_cast<char*>(page));
+        if (syscall(SYS_move_pages, 0, addresses.size(), &addresses[0], 0, &status[0], 0) != 0)
+            return false;
+
+        for (std::size_t i = 0; i < addresses.size(); i++)
+        {
+            if (status[i] < 0)
+            {
+                untouched++; // -ENOENT
+                continue;
+            }
+            if (static_cast<std::size_t>(status[i]) >= pages.size())
+                pages.resize(status[i] + 1, 0);
+            pages[status[i]]++;
+        }
+    }
+    return true;
+}
+#else
+#include <thread>
+
+NumaTopology::NumaTopology() : mNodeCount(1)
+{
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+    {
+        mCpus.push_back(cpu);
+        mNodes.push_back(0);
+    }
+}
+
+bool NumaTopology::pinThread(int)
+{
+    return false;
+}
+
+bool NumaTopology::countPages(const void*, std::size_t, std::vector<std::size_t>& pages, std::size_t& untouched)
+{
+    pages.clear();
+    untouched = 0;
+    return false;
+}
+#endif
+
+const NumaTopology& NumaTopology::getMachine()
+{
+    static const NumaTopology machine;
+    return machine;
+}
+
+int NumaTopology::getCpu(int worker, int workers) const
+{
+    if (mCpus.empty() || workers <= 0)
+        return -1;
+    return mCpus[static_cast<long long>(worker)*static_cast<long long>(mCpus.size())/workers];
+}
+
+int NumaTopology::getNode(int cpu) const
+{
+    for (std::size_t i = 0; i < mCpus.size(); i++)
+    {
+        if (mCpus[i] == cpu)
+            return mNodes[i];
+    }
+    return -1;
+}
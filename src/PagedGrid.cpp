@@ -0,0 +1,581 @@
+#include "PagedGrid.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MemoryReport.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    const std::size_t MinimumResident = 9; // A tile and the eight around it, to step it without dropping any
+
+    const unsigned char EmptyPlane[64*64] = {}; // Current states of a tile without conductors
+
+    /// \brief Whether a row of a tile has no conductors, read eight cells at a time
+    bool isEmpty(const unsigned char* row)
+    {
+        unsigned long long cells = 0;
+        for (int x = 0; x < 64; x += 8)
+        {
+            unsigned long long eight;
+            std::memcpy(&eight, row + x, sizeof(eight));
+            cells |= eight;
+        }
+        return cells == 0;
+    }
+
+    /// \brief Scramble the bits of a value, as Grid::getStateHash() does (the splitmix64 finaliser)
+    unsigned long long mix(unsigned long long value)
+    {
+        value = (value ^ (value >> 30))*0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27))*0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+}
+
+const int PagedGrid::TileSize;
+const int PagedGrid::TileCells;
+const std::size_t PagedGrid::TileBytes;
+
+PagedGrid::PagedGrid(const std::string& path, std::size_t residentTiles) : mPath(path),
+    mBudget(std::max(MinimumResident, residentTiles)), mWidth(0), mHeight(0), mTilesX(0), mTilesY(0), mFile(-1),
+    mData(0), mSize(0), mMark(0), mGeneration(0), mNewest(-1), mOldest(-1), mResident(0), mFaults(0), mEvictions(0), mPrefetches(0),
+    mPrefetchHits(0)
+{
+}
+
+PagedGrid::~PagedGrid()
+{
+    release();
+}
+
+#if defined(__linux__)
+bool PagedGrid::isSupported()
+{
+    return true;
+}
+
+bool PagedGrid::create(int width, int height, std::string& error)
+{
+    release();
+    if (width <= 0 || height <= 0)
+    {
+        error = "A paged grid needs a width and height";
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mTilesX = (width + TileSize - 1)/TileSize;
+    mTilesY = (height + TileSize - 1)/TileSize;
+    Tile empty = {-1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, false, false, false};
+    mTiles.assign(static_cast<std::size_t>(mTilesX)*mTilesY, empty);
+    mActive.clear();
+    mPending.clear();
+    mNewest = -1;
+    mOldest = -1;
+    mResident = 0;
+    mFaults = 0;
+    mEvictions = 0;
+    mPrefetches = 0;
+    mPrefetchHits = 0;
+
+    // The file is sparse: tiles which are never written take no disk
+    mSize = mTiles.size()*TileBytes;
+    mFile = open(mPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (mFile < 0)
+    {
+        error = "Failed to create " + mPath + ": " + std::strerror(errno);
+        return false;
+    }
+    ::unlink(mPath.c_str()); // Gone once closed, however the process ends
+    if (ftruncate(mFile, mSize) != 0)
+    {
+        error = "Failed to size " + mPath + ": " + std::strerror(errno);
+        release();
+        return false;
+    }
+
+    void* data = mmap(0, mSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, mFile, 0);
+    if (data == MAP_FAILED)
+    {
+        error = "Failed to map " + mPath + ": " + std::strerror(errno);
+        release();
+        return false;
+    }
+    mData = static_cast<unsigned char*>(data);
+
+    // Neighbouring tiles in the file are rarely neighbours on the board, so reading ahead wastes memory
+    madvise(mData, mSize, MADV_RANDOM);
+    return true;
+}
+
+void PagedGrid::release()
+{
+    if (mData)
+        munmap(mData, mSize);
+    if (mFile >= 0)
+        close(mFile);
+    mData = 0;
+    mFile = -1;
+}
+
+void PagedGrid::evict(int tile) const
+{
+    // Start writing the tile back, so its pages are clean and can be reclaimed once unmapped
+    off_t offset = static_cast<off_t>(tile)*TileBytes;
+    sync_file_range(mFile, offset, TileBytes, SYNC_FILE_RANGE_WRITE);
+    madvise(mData + offset, TileBytes, MADV_DONTNEED);
+}
+
+void PagedGrid::prefetch(int tile) const
+{
+    madvise(mData + static_cast<std::size_t>(tile)*TileBytes, TileBytes, MADV_WILLNEED);
+}
+#else
+bool PagedGrid::isSupported()
+{
+    return false;
+}
+
+bool PagedGrid::create(int, int, std::string& error)
+{
+    error = "Paged grids need Linux";
+    return false;
+}
+
+void PagedGrid::release()
+{
+}
+
+void PagedGrid::evict(int) const
+{
+}
+
+void PagedGrid::prefetch(int) const
+{
+}
+#endif
+
+bool PagedGrid::loadFromFile(const std::string& filename, std::string& error)
+{
+    TraceScope trace("load", "io");
+
+    std::ifstream file(filename.c_str());
+    int width = 0;
+    int height = 0;
+    file >> width >> height;
+    if (!file || width <= 0 || height <= 0)
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+    if (!create(width, height, error))
+        return false;
+
+    // Read the way Grid::loadFromFile() does, so the cells land in the same places
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            char c = file.get();
+            if (c == '#')
+                setCell(x, y, WIRE);
+            else if (c == '@')
+                setCell(x, y, HEAD);
+            else if (c == '~')
+                setCell(x, y, TAIL);
+        }
+        file.get(); // skip the new line
+    }
+
+    return true;
+}
+
+void PagedGrid::link(int tile) const
+{
+    Tile& entry = mTiles[tile];
+    entry.newer = -1;
+    entry.older = mNewest;
+    if (mNewest >= 0)
+        mTiles[mNewest].newer = tile;
+    else
+        mOldest = tile;
+    mNewest = tile;
+}
+
+void PagedGrid::unlink(int tile) const
+{
+    Tile& entry = mTiles[tile];
+    if (entry.newer >= 0)
+        mTiles[entry.newer].older = entry.older;
+    else
+        mNewest = entry.older;
+    if (entry.older >= 0)
+        mTiles[entry.older].newer = entry.newer;
+    else
+        mOldest = entry.newer;
+}
+
+unsigned char* PagedGrid::touch(int tile) const
+{
+    Tile& entry = mTiles[tile];
+    if (entry.resident)
+    {
+        if (entry.prefetched)
+        {
+            entry.prefetched = false;
+            mPrefetchHits++;
+        }
+        if (mNewest != tile)
+        {
+            unlink(tile);
+            link(tile);
+        }
+    }
+    else
+    {
+        mFaults++;
+        entry.resident = true;
+        link(tile);
+        mResident++;
+        while (mResident > mBudget)
+            evictOldest();
+    }
+    entry.used = mGeneration;
+    return mData + static_cast<std::size_t>(tile)*TileBytes;
+}
+
+void PagedGrid::evictOldest() const
+{
+    int victim = mOldest;
+    unlink(victim);
+    mTiles[victim].resident = false;
+    mTiles[victim].prefetched = false;
+    mResident--;
+    evict(victim);
+    mEvictions++;
+}
+
+int PagedGrid::getNeighbour(int tile, int dx, int dy) const
+{
+    int tx = (tile % mTilesX + dx + mTilesX) % mTilesX;
+    int ty = (tile / mTilesX + dy + mTilesY) % mTilesY;
+    return ty*mTilesX + tx;
+}
+
+const unsigned char* PagedGrid::getCurrent(int tile) const
+{
+    const Tile& entry = mTiles[tile];
+    return entry.conductors > 0 ? touch(tile) + entry.plane*TileCells : EmptyPlane;
+}
+
+void PagedGrid::list(int tile, std::vector<int>& tiles) const
+{
+    if (mTiles[tile].mark == mMark)
+        return;
+    mTiles[tile].mark = mMark;
+    tiles.push_back(tile);
+}
+
+void PagedGrid::update()
+{
+    TraceScope trace("update", "sim");
+
+    // Every next state is worked out afresh, as in Grid::update(), so edits since the last flip()
+    // are dropped. Tiles which aren't stepped stay as they are.
+    for (int tile : mPending)
+        mTiles[tile].pending = false;
+    mPending.clear();
+
+    mGeneration++;
+    listChanging(mPending);
+    std::sort(mPending.begin(), mPending.end()); // In file order
+    for (int tile : mPending)
+        step(tile);
+}
+
+void PagedGrid::listChanging(std::vector<int>& tiles) const
+{
+    tiles.clear();
+    mMark++;
+    for (int tile : mActive)
+    {
+        list(tile, tiles);
+        if (mTiles[tile].heads == 0)
+            continue;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int neighbour = getNeighbour(tile, dx, dy);
+                if (mTiles[neighbour].conductors > 0)
+                    list(neighbour, tiles);
+            }
+        }
+    }
+}
+
+void PagedGrid::step(int tile)
+{
+    const int span = TileSize + 2;
+    int left = tile % mTilesX*TileSize;
+    int top = tile / mTilesX*TileSize;
+    int columns = std::min(TileSize, mWidth - left);
+    int rows = std::min(TileSize, mHeight - top);
+
+    // Gather the tile and a one cell border, wrapping around the edges of the board. The border
+    // columns may come from other tiles, the rest of each row from one.
+    int tx = tile % mTilesX;
+    int leftX = wrapX(left - 1);
+    int rightX = wrapX(left + columns);
+    for (int r = 0; r < rows + 2; r++)
+    {
+        int y = wrapY(top + r - 1);
+        int rowTiles = (y/TileSize)*mTilesX;
+        int rowOffset = (y % TileSize)*TileSize;
+        unsigned char* halo = &mHalo[r*span];
+        halo[0] = getCurrent(rowTiles + leftX/TileSize)[rowOffset + leftX % TileSize];
+        std::memcpy(halo + 1, getCurrent(rowTiles + tx) + rowOffset, TileSize);
+        halo[columns + 1] = getCurrent(rowTiles + rightX/TileSize)[rowOffset + rightX % TileSize];
+    }
+
+    // Work out whole rows without branching, counting the heads around each cell from the heads in
+    // each column of three rows, then empty the cells past the edge of the board
+    Tile& entry = mTiles[tile];
+    unsigned char* next = touch(tile) + (entry.plane ^ 1)*TileCells;
+    int heads = 0;
+    int tails = 0;
+    for (int y = 0; y < rows; y++)
+    {
+        const unsigned char* above = &mHalo[y*span];
+        const unsigned char* row = above + span;
+        const unsigned char* below = row + span;
+        unsigned char* out = &next[y*TileSize];
+        if (isEmpty(row + 1))
+        {
+            std::memset(out, NONE, TileSize); // Empty cells stay empty
+            continue;
+        }
+
+        unsigned char columnHeads[span];
+        for (int x = 0; x < span; x++)
+            columnHeads[x] = (above[x] == HEAD) + (row[x] == HEAD) + (below[x] == HEAD);
+
+        unsigned char cells[TileSize]; // Not the tile, so the compiler needn't check for overlap
+        for (int x = 0; x < TileSize; x++)
+        {
+            unsigned char cell = row[x + 1];
+            unsigned char around = columnHeads[x] + columnHeads[x + 1] + columnHeads[x + 2] - (cell == HEAD);
+            unsigned char fires = static_cast<unsigned char>(around - 1) < 2; // One or two
+            cells[x] = (cell == WIRE)*(WIRE + fires) + (cell == HEAD)*TAIL + (cell == TAIL)*WIRE;
+        }
+        if (columns < TileSize)
+            std::memset(cells + columns, NONE, TileSize - columns);
+
+        for (int x = 0; x < TileSize; x++)
+        {
+            heads += cells[x] == HEAD;
+            tails += cells[x] == TAIL;
+        }
+        std::memcpy(out, cells, TileSize);
+    }
+    if (rows < TileSize)
+        std::memset(next + rows*TileSize, NONE, (TileSize - rows)*TileSize);
+
+    entry.nextConductors = entry.conductors;
+    entry.nextHeads = heads;
+    entry.nextTails = tails;
+    entry.pending = true;
+}
+
+void PagedGrid::flip()
+{
+    TraceScope trace("flip", "sim");
+
+    mMark++;
+    mScratch.clear();
+    for (int tile : mPending)
+    {
+        Tile& entry = mTiles[tile];
+        entry.plane ^= 1;
+        entry.conductors = entry.nextConductors;
+        entry.heads = entry.nextHeads;
+        entry.tails = entry.nextTails;
+        entry.pending = false;
+        if (entry.heads + entry.tails > 0)
+            list(tile, mScratch);
+    }
+    for (int tile : mActive)
+    {
+        if (mTiles[tile].heads + mTiles[tile].tails > 0)
+            list(tile, mScratch);
+    }
+    mActive.swap(mScratch);
+    mPending.clear();
+
+    // The next update() reads the tiles it steps and the ones around them. As the electrons move
+    // on, the outer ones are often new. Ask for those which aren't resident, making room by dropping
+    // tiles the last update() didn't use. Once those run out, the rest would only push out tiles
+    // which are about to be needed.
+    listChanging(mScratch);
+    for (int tile : mScratch)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int neighbour = getNeighbour(tile, dx, dy);
+                Tile& entry = mTiles[neighbour];
+                if (entry.conductors == 0 || entry.resident)
+                    continue;
+                if (mResident >= mBudget)
+                {
+                    if (mTiles[mOldest].used == mGeneration)
+                        return;
+                    evictOldest();
+                }
+
+                prefetch(neighbour);
+                entry.resident = true;
+                entry.prefetched = true;
+                entry.used = mGeneration;
+                link(neighbour);
+                mResident++;
+                mPrefetches++;
+            }
+        }
+    }
+}
+
+CellState PagedGrid::getCell(int x, int y) const
+{
+    int tile = getTile(x, y);
+    const Tile& entry = mTiles[tile];
+    if (entry.conductors == 0)
+        return NONE;
+    return static_cast<CellState>(touch(tile)[entry.plane*TileCells + getOffset(x, y)]);
+}
+
+CellState PagedGrid::getNextCell(int x, int y) const
+{
+    int tile = getTile(x, y);
+    const Tile& entry = mTiles[tile];
+    if (!entry.pending)
+        return getCell(x, y);
+    return static_cast<CellState>(touch(tile)[(entry.plane ^ 1)*TileCells + getOffset(x, y)]);
+}
+
+void PagedGrid::setCell(int x, int y, CellState cell)
+{
+    if (x < 0 || y < 0 || x >= mWidth || y >= mHeight)
+        return;
+
+    int tile = getTile(x, y);
+    Tile& entry = mTiles[tile];
+    if (!entry.pending && entry.conductors == 0 && cell == NONE)
+        return; // Already empty, so leave the tile unread
+
+    // The next plane starts out as a copy of the current one
+    unsigned char* planes = touch(tile);
+    unsigned char* next = planes + (entry.plane ^ 1)*TileCells;
+    if (!entry.pending)
+    {
+        std::memcpy(next, planes + entry.plane*TileCells, TileCells);
+        entry.nextConductors = entry.conductors;
+        entry.nextHeads = entry.heads;
+        entry.nextTails = entry.tails;
+        entry.pending = true;
+        mPending.push_back(tile);
+    }
+
+    unsigned char& target = next[getOffset(x, y)];
+    entry.nextConductors += (cell != NONE) - (target != NONE);
+    entry.nextHeads += (cell == HEAD) - (target == HEAD);
+    entry.nextTails += (cell == TAIL) - (target == TAIL);
+    target = cell;
+}
+
+int PagedGrid::wrapX(int x) const
+{
+    x %= mWidth;
+    return x < 0 ? x + mWidth : x;
+}
+
+int PagedGrid::wrapY(int y) const
+{
+    y %= mHeight;
+    return y < 0 ? y + mHeight : y;
+}
+
+bool PagedGrid::hasHeads() const
+{
+    for (int tile : mActive)
+    {
+        if (mTiles[tile].heads > 0)
+            return true;
+    }
+    return false;
+}
+
+unsigned long long PagedGrid::getStateHash() const
+{
+    unsigned long long hash = 0;
+    for (int tile : mActive)
+    {
+        const unsigned char* cells = touch(tile) + mTiles[tile].plane*TileCells;
+        unsigned long long left = tile % mTilesX*TileSize;
+        unsigned long long top = tile / mTilesX*TileSize;
+        for (int i = 0; i < TileCells; i++)
+        {
+            // Cells past the edge of the board are always empty
+            if (cells[i] == HEAD || cells[i] == TAIL)
+                hash += mix(4*((top + i/TileSize)*mWidth + left + i % TileSize) + cells[i]);
+        }
+    }
+    return hash;
+}
+
+void PagedGrid::reportMemory(MemoryReport& report) const
+{
+    report.add("tile table", mTiles.size()*sizeof(Tile), mTiles.capacity()*sizeof(Tile));
+    std::size_t used = (mActive.size() + mPending.size() + mScratch.size())*sizeof(int);
+    std::size_t reserved = (mActive.capacity() + mPending.capacity() + mScratch.capacity())*sizeof(int);
+    report.add("tile lists", used, reserved);
+    report.add("resident tiles", mResident*TileBytes, mResident*TileBytes);
+}
+
+void PagedGrid::printStats(std::ostream& out) const
+{
+    std::size_t conductors = 0;
+    for (const Tile& tile : mTiles)
+        conductors += tile.conductors > 0;
+
+    out << mTiles.size() << " tiles of " << TileSize << "x" << TileSize << " (" << mTilesX << "x" << mTilesY << "), "
+        << conductors << " with conductors, " << mActive.size() << " with electrons\n";
+    out << mResident << " of " << mBudget << " tiles resident (" << std::fixed << std::setprecision(1)
+        << mBudget*TileBytes/(1024.0*1024.0) << " MB), " << mFaults << " faults, " << mEvictions << " evictions, "
+        << mPrefetches << " prefetched, " << mPrefetchHits << " of them used in time\n";
+
+#if defined(__linux__)
+    struct stat status;
+    if (mFile >= 0 && fstat(mFile, &status) == 0)
+    {
+        out << "tile file " << status.st_size/(1024.0*1024.0) << " MB, "
+            << status.st_blocks*512.0/(1024.0*1024.0) << " MB of it on disk\n";
+    }
+#endif
+    out.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,126 @@
+#include "PerfCounters.hpp"
+
+#if defined(__linux__)
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    int openCounter(unsigned type, unsigned long long config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // Count the threads started later too. The kernel refuses group reads then.
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+PerfCounters::PerfCounters()
+{
+    const unsigned long long l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    mFds[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    mFds[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    mFds[L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE, l1dReadMiss);
+    mFds[LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    mFds[BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : mFds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void PerfCounters::start()
+{
+    for (int fd : mFds)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop(unsigned long long totals[COUNTER_COUNT])
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (mFds[i] >= 0)
+            ioctl(mFds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        unsigned long long values[3]; // Count, time enabled, time running
+        if (mFds[i] < 0 || read(mFds[i], values, sizeof(values)) != sizeof(values))
+            continue;
+
+        if (values[2] > 0 && values[2] < values[1])
+            values[0] = static_cast<unsigned long long>(static_cast<double>(values[0])*values[1]/values[2]);
+        totals[i] += values[0];
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        mFds[i] = -1;
+}
+
+PerfCounters::~PerfCounters()
+{
+}
+
+void PerfCounters::start()
+{
+}
+
+void PerfCounters::stop(unsigned long long[COUNTER_COUNT])
+{
+}
+
+#endif
+
+bool PerfCounters::isAvailable() const
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (isAvailable(static_cast<Counter>(i)))
+            return true;
+    }
+    return false;
+}
+
+const char* PerfCounters::getCounterName(Counter counter)
+{
+    switch (counter)
+    {
+        case CYCLES: return "cycles";
+        case INSTRUCTIONS: return "instructions";
+        case L1D_MISSES: return "L1d misses";
+        case LLC_MISSES: return "LLC misses";
+        case BRANCH_MISSES: return "branch misses";
+        default: return "?";
+    }
+}
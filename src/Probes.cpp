@@ -0,0 +1,177 @@
+#include "Probes.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "MemoryReport.hpp"
+
+namespace
+{
+    const int MaxBusWidth = 64; // Bits in a decoded word
+
+    /// \brief Read coordinates in the form x,y
+    bool parseCoords(const std::string& text, int& x, int& y)
+    {
+        char comma = 0;
+        std::istringstream coords(text);
+        return coords >> x >> comma >> y && comma == ',' && coords.peek() == EOF;
+    }
+}
+
+void Probes::add(const std::string& name, int x, int y)
+{
+    Probe probe = {name, x, y, -1, 0};
+
+    // A name ending in [n] makes the probe bit n of a bus
+    std::size_t open = name.find('[');
+    int bit = 0;
+    char close = 0;
+    if (open != std::string::npos && open > 0 && name[name.size() - 1] == ']')
+    {
+        std::istringstream index(name.substr(open + 1));
+        if (index >> bit >> close && close == ']' && bit >= 0 && bit < MaxBusWidth)
+        {
+            std::string busName = name.substr(0, open);
+            std::size_t bus = 0;
+            while (bus < mBuses.size() && mBuses[bus].name != busName)
+                bus++;
+            if (bus == mBuses.size())
+            {
+                Bus newBus = {busName, 0};
+                mBuses.push_back(newBus);
+            }
+            mBuses[bus].width = std::max(mBuses[bus].width, bit + 1);
+            probe.bus = bus;
+            probe.bit = bit;
+        }
+    }
+
+    mProbes.push_back(probe);
+}
+
+bool Probes::parse(const std::string& text, std::string& error)
+{
+    std::size_t equals = text.find('=');
+    int x = 0;
+    int y = 0;
+    if (equals == std::string::npos || equals == 0 || !parseCoords(text.substr(equals + 1), x, y))
+    {
+        error = "Expected a probe as name=x,y but got " + text;
+        return false;
+    }
+
+    add(text.substr(0, equals), x, y);
+    return true;
+}
+
+bool Probes::loadFromFile(const std::string& filename, std::string& error)
+{
+    std::ifstream file(filename.c_str());
+    if (!file)
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+    {
+        std::istringstream tokens(line);
+        std::string name;
+        if (!(tokens >> name) || name.compare(0, 2, "//") == 0)
+            continue;
+
+        std::string coords;
+        std::string extra;
+        int x = 0;
+        int y = 0;
+        if (!(tokens >> coords) || !parseCoords(coords, x, y) || tokens >> extra)
+        {
+            std::ostringstream where;
+            where << filename << ":" << lineNumber << ": expected a name and x,y";
+            error = where.str();
+            return false;
+        }
+
+        add(name, x, y);
+    }
+
+    return true;
+}
+
+void Probes::writeEvents(std::ostream& out) const
+{
+    for (const Event& event : mEvents)
+        out << event.generation << " " << mProbes[event.probe].name << "\n";
+}
+
+void Probes::writeDecoded(std::ostream& out) const
+{
+    // Events are logged in generation order, so each generation's heads are next to each other
+    std::vector<unsigned long long> words(mBuses.size(), 0);
+    std::vector<bool> seen(mBuses.size(), false);
+    for (std::size_t i = 0; i < mEvents.size(); i++)
+    {
+        const Probe& probe = mProbes[mEvents[i].probe];
+        if (probe.bus >= 0)
+        {
+            words[probe.bus] |= 1ull << probe.bit;
+            seen[probe.bus] = true;
+        }
+
+        if (i + 1 < mEvents.size() && mEvents[i+1].generation == mEvents[i].generation)
+            continue;
+
+        for (std::size_t bus = 0; bus < mBuses.size(); bus++)
+        {
+            if (!seen[bus])
+                continue;
+            out << mEvents[i].generation << " " << mBuses[bus].name << " " << words[bus] << " ";
+            for (int bit = mBuses[bus].width - 1; bit >= 0; bit--)
+                out << ((words[bus] >> bit) & 1);
+            out << "\n";
+            words[bus] = 0;
+            seen[bus] = false;
+        }
+    }
+}
+
+void Probes::printSummary(std::ostream& out) const
+{
+    struct Stats
+    {
+        long long count;
+        long long first;
+        long long last;
+        long long gap;
+    };
+
+    std::vector<Stats> stats(mProbes.size(), Stats{0, 0, 0, 0});
+    for (const Event& event : mEvents)
+    {
+        Stats& probe = stats[event.probe];
+        if (probe.count == 0)
+            probe.first = event.generation;
+        else
+            probe.gap = event.generation - probe.last;
+        probe.last = event.generation;
+        probe.count++;
+    }
+
+    for (std::size_t i = 0; i < mProbes.size(); i++)
+    {
+        out << std::left << std::setw(20) << mProbes[i].name << std::right << " heads " << std::setw(8) << stats[i].count;
+        if (stats[i].count > 0)
+            out << "  first " << stats[i].first << "  last " << stats[i].last;
+        if (stats[i].count > 1)
+            out << "  gap " << stats[i].gap;
+        out << "\n";
+    }
+}
+
+void Probes::reportMemory(MemoryReport& report) const
+{
+    report.add("probe events", mEvents.size()*sizeof(Event), mEvents.capacity()*sizeof(Event));
+}
@@ -0,0 +1,330 @@
+#include "Publisher.hpp"
+
+#include <algorithm>
+
+#include "QueuedSocket.hpp"
+
+namespace
+{
+    const int MaxGap = 8; // Unchanged cells worth folding into a run rather than starting a new one
+    const std::chrono::seconds LagLimit(5); // Longest a viewer may take over a frame before it is dropped
+
+    void writeVarint(std::string& out, unsigned long long value)
+    {
+        while (value >= 0x80)
+        {
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    bool readVarint(const std::string& in, std::size_t& pos, unsigned long long& value)
+    {
+        value = 0;
+        for (int shift = 0; pos < in.size() && shift < 64; shift += 7)
+        {
+            unsigned char byte = in[pos++];
+            value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+}
+
+Publisher::Publisher() : mWidth(0), mHeight(0), mHasViewers(false), mFrameGeneration(0), mFrameWidth(0),
+    mFrameHeight(0), mHasFrame(false), mRunning(false)
+{
+}
+
+Publisher::~Publisher()
+{
+    stop();
+}
+
+bool Publisher::start(unsigned short port, int width, int height, float fps)
+{
+    mWidth = width;
+    mHeight = height;
+    mInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0/std::max(fps, 0.01f)));
+    mNextFrame = std::chrono::steady_clock::now();
+
+    if (mListener.listen(port) != sf::Socket::Done)
+        return false;
+
+    mRunning = true;
+    mThread = std::thread(&Publisher::publish, this);
+    return true;
+}
+
+void Publisher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunning = false;
+        mChanged.notify_all();
+    }
+    if (mThread.joinable())
+        mThread.join();
+    mListener.close();
+}
+
+void Publisher::publish()
+{
+    // A viewer is sent a frame at a time, as its socket takes it. Frames which come up while one is
+    // on its way are skipped for that viewer alone, and the next one it is sent carries the changes
+    // since the one before, kept for it in cells once the other viewers have moved on.
+    struct Viewer
+    {
+        std::unique_ptr<QueuedSocket> socket;
+        long long frame; // Serial of the last frame queued, -1 before the keyframe
+        std::vector<unsigned char> cells; // That frame, if it isn't the last one
+        std::chrono::steady_clock::time_point queued; // When the frame on its way was queued
+    };
+
+    sf::SocketSelector selector;
+    selector.add(mListener);
+    std::vector<Viewer> viewers;
+    std::vector<unsigned char> last; // Last frame handed over, empty before the first
+    long long lastSerial = 0;
+    int lastWidth = 0;
+    int lastHeight = 0;
+    std::vector<unsigned char> frame;
+    long long generation = 0;
+    int width = 0;
+    int height = 0;
+    std::string changes;
+
+    while (true)
+    {
+        bool sending = false;
+        for (const Viewer& viewer : viewers)
+            sending = sending || viewer.socket->isSending();
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (!mHasFrame && mRunning && !sending)
+                mChanged.wait_for(lock, std::chrono::milliseconds(20));
+            if (!mRunning)
+                break;
+            if (mHasFrame)
+            {
+                frame.swap(mFrame);
+                generation = mFrameGeneration;
+                width = mFrameWidth;
+                height = mFrameHeight;
+                mHasFrame = false;
+            }
+        }
+
+        // New viewers and viewers which went away. Viewers never send anything.
+        if (selector.wait(sf::milliseconds(1)))
+        {
+            if (selector.isReady(mListener))
+            {
+                Viewer viewer = {std::unique_ptr<QueuedSocket>(new QueuedSocket), -1, std::vector<unsigned char>(),
+                                 std::chrono::steady_clock::now()};
+                if (mListener.accept(*viewer.socket) == sf::Socket::Done)
+                {
+                    selector.add(*viewer.socket);
+                    viewers.push_back(std::move(viewer));
+                }
+            }
+            for (std::size_t i = 0; i < viewers.size();)
+            {
+                char byte;
+                std::size_t received = 0;
+                sf::Socket::Status status = selector.isReady(*viewers[i].socket) ?
+                                            viewers[i].socket->receive(&byte, 1, received) : sf::Socket::NotReady;
+                if (status == sf::Socket::Disconnected || status == sf::Socket::Error)
+                {
+                    selector.remove(*viewers[i].socket);
+                    viewers.erase(viewers.begin() + i);
+                }
+                else
+                    i++;
+            }
+            mHasViewers = !viewers.empty();
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (!frame.empty())
+        {
+            TraceScope trace("queue frame", "io");
+            long long serial = lastSerial + 1;
+
+            // A board of another size has nothing to take changes from, so every viewer starts again
+            if (width != lastWidth || height != lastHeight)
+            {
+                for (Viewer& viewer : viewers)
+                {
+                    viewer.frame = -1;
+                    std::vector<unsigned char>().swap(viewer.cells);
+                }
+                lastWidth = width;
+                lastHeight = height;
+            }
+
+            sf::Packet delta; // From the last frame, shared by the viewers which were sent it
+            sf::Packet keyframe;
+            for (Viewer& viewer : viewers)
+            {
+                if (viewer.socket->isSending())
+                    continue;
+
+                sf::Packet own;
+                sf::Packet* packet = &own;
+                if (viewer.frame < 0)
+                {
+                    if (keyframe.getDataSize() == 0)
+                    {
+                        changes.clear();
+                        encode(std::vector<unsigned char>(frame.size(), NONE), frame, changes);
+                        keyframe << sf::Uint8(KEYFRAME) << sf::Uint32(generation) << sf::Uint32(width) << sf::Uint32(height) << changes;
+                    }
+                    packet = &keyframe;
+                }
+                else if (viewer.frame == lastSerial)
+                {
+                    if (delta.getDataSize() == 0)
+                    {
+                        changes.clear();
+                        encode(last, frame, changes);
+                        delta << sf::Uint8(DELTA) << sf::Uint32(generation) << sf::Uint32(width) << sf::Uint32(height) << changes;
+                    }
+                    packet = &delta;
+                }
+                else
+                {
+                    changes.clear();
+                    encode(viewer.cells, frame, changes);
+                    own << sf::Uint8(DELTA) << sf::Uint32(generation) << sf::Uint32(width) << sf::Uint32(height) << changes;
+                    std::vector<unsigned char>().swap(viewer.cells);
+                }
+
+                viewer.socket->queue(*packet);
+                viewer.frame = serial;
+                viewer.queued = now;
+            }
+
+            // Viewers still busy with the last frame need it to work out their next one
+            for (Viewer& viewer : viewers)
+            {
+                if (viewer.frame == lastSerial)
+                    viewer.cells = last;
+            }
+
+            last.swap(frame);
+            lastSerial = serial;
+            frame.clear();
+        }
+
+        for (std::size_t i = 0; i < viewers.size();)
+        {
+            Viewer& viewer = viewers[i];
+            if (!viewer.socket->flush() || (viewer.socket->isSending() && now - viewer.queued > LagLimit))
+            {
+                selector.remove(*viewer.socket);
+                viewer.socket->disconnect();
+                viewers.erase(viewers.begin() + i);
+                continue;
+            }
+            i++;
+        }
+        mHasViewers = !viewers.empty();
+    }
+
+    for (Viewer& viewer : viewers)
+        viewer.socket->disconnect();
+}
+
+void Publisher::copyCells(const Grid& board, std::vector<unsigned char>& cells, int& width, int& height) const
+{
+    // Always the board's own size, which a control client's LOAD may have changed since start()
+    width = board.getWidth();
+    height = board.getHeight();
+    cells.resize(width*height);
+    if (board.getLayout() != Grid::ROWS)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+                cells[y*width + x] = board.getCell(x, y);
+        }
+        return;
+    }
+
+    // Straight through the cells in memory, which are row-major
+    const unsigned char* data = board.getCellData();
+    std::size_t stride = Grid::getCellStride();
+    for (std::size_t i = 0; i < cells.size(); i++)
+        cells[i] = data[i*stride];
+}
+
+void Publisher::encode(const std::vector<unsigned char>& from, const std::vector<unsigned char>& to, std::string& out)
+{
+    std::size_t end = 0; // End of the last run
+    std::size_t i = 0;
+    while (i < to.size())
+    {
+        if (from[i] == to[i])
+        {
+            i++;
+            continue;
+        }
+
+        // Extend the run while the next change is close enough
+        std::size_t start = i;
+        std::size_t last = i;
+        for (i++; i < to.size() && i - last <= MaxGap; i++)
+        {
+            if (from[i] != to[i])
+                last = i;
+        }
+        std::size_t length = last + 1 - start;
+
+        writeVarint(out, start - end);
+        writeVarint(out, length);
+        for (std::size_t k = 0; k < length; k += 4)
+        {
+            unsigned char packed = 0;
+            for (std::size_t j = 0; j < 4 && k + j < length; j++)
+                packed |= (to[start + k + j] & 3) << (2*j);
+            out += static_cast<char>(packed);
+        }
+
+        end = last + 1;
+        i = end;
+    }
+}
+
+bool Publisher::decode(const std::string& changes, std::vector<unsigned char>& cells, std::vector<int>& changed)
+{
+    std::size_t pos = 0;
+    unsigned long long cell = 0;
+    while (pos < changes.size())
+    {
+        unsigned long long gap = 0;
+        unsigned long long length = 0;
+        if (!readVarint(changes, pos, gap) || !readVarint(changes, pos, length))
+            return false;
+        cell += gap;
+        if (cell + length > cells.size() || pos + (length + 3)/4 > changes.size())
+            return false;
+
+        for (unsigned long long k = 0; k < length; k++)
+        {
+            unsigned char state = (changes[pos + k/4] >> (2*(k % 4))) & 3;
+            if (cells[cell + k] != state)
+            {
+                cells[cell + k] = state;
+                changed.push_back(cell + k);
+            }
+        }
+        pos += (length + 3)/4;
+        cell += length;
+    }
+
+    return true;
+}
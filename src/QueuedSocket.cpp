@@ -0,0 +1,54 @@
+#include "QueuedSocket.hpp"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <cerrno>
+
+#include <sys/socket.h>
+#endif
+
+namespace
+{
+#if defined(MSG_NOSIGNAL)
+    const int SendFlags = MSG_NOSIGNAL; // A peer which has gone is an error, not SIGPIPE
+#else
+    const int SendFlags = 0;
+#endif
+}
+
+QueuedSocket::QueuedSocket() : mSent(0)
+{
+    setBlocking(false); // Applied to the connection when it is accepted or made
+}
+
+void QueuedSocket::queue(const sf::Packet& packet)
+{
+    sf::Uint32 size = static_cast<sf::Uint32>(packet.getDataSize());
+    char header[4] = {static_cast<char>(size >> 24), static_cast<char>(size >> 16), static_cast<char>(size >> 8),
+                      static_cast<char>(size)};
+    mQueue.append(header, sizeof(header));
+    if (size > 0)
+        mQueue.append(static_cast<const char*>(packet.getData()), size);
+}
+
+bool QueuedSocket::flush()
+{
+    while (mSent < mQueue.size())
+    {
+#if defined(_WIN32)
+        int written = ::send(getHandle(), mQueue.data() + mSent, static_cast<int>(mQueue.size() - mSent), SendFlags);
+        if (written < 0)
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        ssize_t written = ::send(getHandle(), mQueue.data() + mSent, mQueue.size() - mSent, SendFlags);
+        if (written < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+        mSent += written;
+    }
+
+    mQueue.clear();
+    mSent = 0;
+    return true;
+}
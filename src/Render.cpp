@@ -0,0 +1,102 @@
+#include <SFML/Graphics.hpp>
+
+#include "Grid.hpp"
+#include "InfiniteGrid.hpp"
+#include "Trace.hpp"
+
+// Drawing is kept apart from the simulation so that the headless library doesn't need SFML
+
+void Grid::draw(sf::RenderTarget& target) const
+{
+    draw(target, sf::RenderStates::Default);
+}
+
+void Grid::draw(sf::RenderTarget& target, const sf::RenderStates& states) const
+{
+    TraceScope trace("draw", "render");
+
+    const sf::View& view = target.getView();
+    sf::FloatRect viewRect(view.getCenter().x-view.getSize().x/2, view.getCenter().y-view.getSize().y/2, view.getSize().x, view.getSize().y);
+
+    sf::RectangleShape rect(sf::Vector2f(TILE_SIZE, TILE_SIZE));
+    for (unsigned index : mInteresting)
+    {
+        Position pos = getPosition(index);
+        int x = pos.x;
+        int y = pos.y;
+
+        if (!viewRect.intersects(sf::FloatRect(x*TILE_SIZE, y*TILE_SIZE, (x+1)*TILE_SIZE, (y+1)*TILE_SIZE)))
+            continue;
+
+        rect.setPosition(x*TILE_SIZE, y*TILE_SIZE);
+
+        switch (getCell(x, y))
+        {
+        case NONE: // Air
+            rect.setFillColor(sf::Color::Black);
+            break;
+        case WIRE: // Wire
+            rect.setFillColor(sf::Color::Yellow);
+            break;
+        case HEAD: // Electron head
+            rect.setFillColor(sf::Color::Blue);
+            break;
+        case TAIL: // Electron tail
+            rect.setFillColor(sf::Color::Red);
+            break;
+        }
+
+        target.draw(rect, states);
+    }
+}
+
+void InfiniteGrid::draw(sf::RenderTarget& target) const
+{
+    draw(target, sf::RenderStates::Default);
+}
+
+void InfiniteGrid::draw(sf::RenderTarget& target, const sf::RenderStates& states) const
+{
+    TraceScope trace("draw", "render");
+
+    const sf::View& view = target.getView();
+    sf::FloatRect viewRect(view.getCenter().x-view.getSize().x/2, view.getCenter().y-view.getSize().y/2, view.getSize().x, view.getSize().y);
+
+    sf::RectangleShape rect(sf::Vector2f(TILE_SIZE, TILE_SIZE));
+    const float span = CHUNK_SIZE*TILE_SIZE;
+    for (const Chunk* chunk : mChunks)
+    {
+        if (!viewRect.intersects(sf::FloatRect(chunk->cx*span, chunk->cy*span, span, span)))
+            continue;
+
+        TraceScope task("chunk", "render");
+
+        for (const CellBlock* block = chunk->cells; block; block = block->next)
+        {
+            for (int i = 0; i < block->count; i++)
+            {
+                int index = block->cells[i];
+                int x = chunk->cx*CHUNK_SIZE + index % CHUNK_SIZE;
+                int y = chunk->cy*CHUNK_SIZE + index / CHUNK_SIZE;
+
+                switch (chunk->current[index])
+                {
+                case WIRE: // Wire
+                    rect.setFillColor(sf::Color::Yellow);
+                    break;
+                case HEAD: // Electron head
+                    rect.setFillColor(sf::Color::Blue);
+                    break;
+                case TAIL: // Electron tail
+                    rect.setFillColor(sf::Color::Red);
+                    break;
+                default: // Air
+                    continue;
+                }
+
+                rect.setPosition(x*TILE_SIZE, y*TILE_SIZE);
+                target.draw(rect, states);
+            }
+        }
+    }
+}
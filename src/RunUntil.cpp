@@ -0,0 +1,86 @@
+#include "RunUntil.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+RunUntil::RunUntil(long long limit) : mLimit(limit), mQuiescent(false), mRepeat(false), mAnyProbe(false),
+    mReason(LIMIT), mGeneration(0), mPeriod(0), mProbe(-1)
+{
+}
+
+bool RunUntil::parse(const std::string& text, std::string& error)
+{
+    if (text == "quiet")
+        mQuiescent = true;
+    else if (text == "repeat")
+        mRepeat = true;
+    else if (text == "probe")
+        mAnyProbe = true;
+    else if (text.compare(0, 6, "probe=") == 0 && text.size() > 6)
+        mProbeNames.push_back(text.substr(6));
+    else
+    {
+        char* end = 0;
+        long long generations = std::strtoll(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || generations < 0)
+        {
+            error = "Unknown stop condition " + text + " (expected quiet, repeat, probe, probe=name or a generation count)";
+            return false;
+        }
+        mLimit = std::min(mLimit, generations);
+    }
+
+    return true;
+}
+
+bool RunUntil::validate(const Probes& probes, std::string& error) const
+{
+    for (const std::string& name : mProbeNames)
+    {
+        std::size_t probe = 0;
+        while (probe < probes.getCount() && probes.getName(probe) != name)
+            probe++;
+        if (probe == probes.getCount())
+        {
+            error = "No probe is called " + name;
+            return false;
+        }
+    }
+    return true;
+}
+
+void RunUntil::printResult(std::ostream& out, const Probes& probes) const
+{
+    out << "Stopped at generation " << mGeneration << ": ";
+    switch (mReason)
+    {
+        case LIMIT:
+            out << "reached the generation limit";
+            break;
+        case PROBE:
+            out << "probe " << probes.getName(mProbe) << " saw a head";
+            break;
+        case QUIESCENT:
+            out << "no heads left";
+            break;
+        case REPEAT:
+            out << "the state repeats every " << mPeriod << " generations";
+            break;
+    }
+    out << "\n";
+}
+
+bool RunUntil::probeFired(const Probes& probes, std::size_t firstEvent)
+{
+    const std::vector<Probes::Event>& events = probes.getEvents();
+    for (std::size_t i = firstEvent; i < events.size(); i++)
+    {
+        const std::string& name = probes.getName(events[i].probe);
+        if (mAnyProbe || std::find(mProbeNames.begin(), mProbeNames.end(), name) != mProbeNames.end())
+        {
+            mProbe = events[i].probe;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,377 @@
+#include "SlabRunner.hpp"
+
+#include <iomanip>
+
+#if defined(__linux__)
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    // Checks of the barrier before a worker sleeps on the futex. Neighbouring slabs usually
+    // arrive within microseconds of each other, much less than a sleep and wake up takes.
+    const int SpinCount = 2000;
+
+    enum Edge
+    {
+        TOP,
+        BOTTOM
+    };
+
+    /// \brief The start of the shared memory. The slab results and the rows follow it.
+    struct Header
+    {
+        std::atomic<unsigned> arrived; // Workers at the barrier
+        std::atomic<unsigned> phase; // Futex word, bumped each time every worker has arrived
+        std::atomic<int> aborted; // Set by the coordinator when a worker dies
+        double seconds;
+        unsigned long long checksum; // Passed from slab to slab
+    };
+
+    struct SlabResult
+    {
+        int heads;
+        int tails;
+        unsigned long long peakRss;
+    };
+
+    static_assert(sizeof(std::atomic<unsigned>) == sizeof(int), "The barrier phase has to be a futex word");
+
+    std::size_t roundUp(std::size_t bytes)
+    {
+        return (bytes + 63) & ~std::size_t(63);
+    }
+
+    /// \brief Where everything is in the shared memory. Each slab has two slots per edge, used in
+    /// alternate generations, so a worker can write its next rows while a slower neighbour is still
+    /// reading the last ones. It can't get two generations ahead, because of the barrier.
+    struct Shared
+    {
+        Shared(void* memory, int width, int slabs) : base(static_cast<unsigned char*>(memory)), width(width), slabs(slabs)
+        {
+        }
+
+        static std::size_t getSize(int width, int slabs)
+        {
+            return roundUp(sizeof(Header)) + roundUp(slabs*sizeof(SlabResult)) + roundUp(width)*slabs*4;
+        }
+
+        Header& header() const {return *reinterpret_cast<Header*>(base);}
+
+        SlabResult& result(int slab) const
+        {
+            return reinterpret_cast<SlabResult*>(base + roundUp(sizeof(Header)))[slab];
+        }
+
+        unsigned char* row(int slab, Edge edge, int slot) const
+        {
+            return base + roundUp(sizeof(Header)) + roundUp(slabs*sizeof(SlabResult)) +
+                   roundUp(width)*(slab*4 + edge*2 + slot);
+        }
+
+        unsigned char* base;
+        int width;
+        int slabs;
+    };
+
+    long futex(std::atomic<unsigned>& word, int op, unsigned value)
+    {
+        return syscall(SYS_futex, reinterpret_cast<int*>(&word), op, value, nullptr, nullptr, 0);
+    }
+
+    /// \brief Wait until every worker has arrived
+    /// \return false if the run was aborted
+    bool waitAtBarrier(Header& header, unsigned parties)
+    {
+        unsigned phase = header.phase.load(std::memory_order_acquire);
+        if (header.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == parties)
+        {
+            // Reset before releasing the others, who may arrive at the next barrier straight away
+            header.arrived.store(0, std::memory_order_relaxed);
+            header.phase.store(phase + 1, std::memory_order_release);
+            futex(header.phase, FUTEX_WAKE, INT_MAX);
+        }
+        else
+        {
+            for (int spin = 0; spin < SpinCount && header.phase.load(std::memory_order_acquire) == phase; spin++)
+            {
+            }
+            // The futex only sleeps while the phase is unchanged, so a wake up can't be missed. A
+            // worker arriving after an abort has read the bumped phase, and sees the flag set first.
+            while (header.phase.load(std::memory_order_acquire) == phase && header.aborted.load() == 0)
+                futex(header.phase, FUTEX_WAIT, phase);
+        }
+        return header.aborted.load() == 0;
+    }
+
+    /// \brief Body of a worker process, which owns one slab. Its grid holds the slab's rows with a
+    /// halo row above and below, which wrap around the board like the rows of a Grid.
+    /// \return the exit status
+    int runWorker(const Shared& shared, const std::string& filename, Grid::Engine engine, int slab, int firstRow,
+                  int rows, int generations)
+    {
+        // Nothing is left to wait for the workers if the coordinator goes
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        Header& header = shared.header();
+        unsigned parties = shared.slabs;
+
+        Grid grid;
+        if (!grid.loadFromFile(filename, 0, firstRow - 1, 0, rows + 2))
+            return 1;
+        grid.setEngine(engine);
+        grid.flip(); // Commit the loaded cells
+
+        int width = grid.getWidth();
+        int above = (slab + shared.slabs - 1) % shared.slabs;
+        int below = (slab + 1) % shared.slabs;
+
+        if (!waitAtBarrier(header, parties))
+            return 1;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int generation = 0; generation < generations; generation++)
+        {
+            grid.update();
+
+            // Publish the next state of the first and last rows of the slab
+            int slot = generation & 1;
+            unsigned char* top = shared.row(slab, TOP, slot);
+            unsigned char* bottom = shared.row(slab, BOTTOM, slot);
+            for (int x = 0; x < width; x++)
+            {
+                top[x] = grid.getNextCell(x, 1);
+                bottom[x] = grid.getNextCell(x, rows);
+            }
+
+            if (!waitAtBarrier(header, parties))
+                return 1;
+
+            // The halos were updated from stale cells, so take the neighbours' rows instead. The
+            // edits are pending, like those made in the window between update() and flip().
+            const unsigned char* halos[2] = {shared.row(above, BOTTOM, slot), shared.row(below, TOP, slot)};
+            const int haloRows[2] = {0, rows + 1};
+            for (int i = 0; i < 2; i++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (grid.getNextCell(x, haloRows[i]) != halos[i][x])
+                        grid.setCell(x, haloRows[i], static_cast<CellState>(halos[i][x]));
+                }
+            }
+            grid.flip();
+        }
+
+        if (!waitAtBarrier(header, parties))
+            return 1;
+        if (slab == 0)
+            header.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        SlabResult& result = shared.result(slab);
+        result.heads = 0;
+        result.tails = 0;
+        for (int y = 1; y <= rows; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                CellState cell = grid.getCell(x, y);
+                result.heads += cell == HEAD;
+                result.tails += cell == TAIL;
+            }
+        }
+        struct rusage usage;
+        result.peakRss = getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<unsigned long long>(usage.ru_maxrss)*1024 : 0;
+
+        // FNV-1a of the whole board in row-major order, carried on by each slab in turn
+        for (int turn = 0; turn < shared.slabs; turn++)
+        {
+            if (turn == slab)
+            {
+                unsigned long long hash = slab == 0 ? 14695981039346656037ull : header.checksum;
+                for (int y = 1; y <= rows; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        hash ^= static_cast<unsigned char>(grid.getCell(x, y));
+                        hash *= 1099511628211ull;
+                    }
+                }
+                header.checksum = hash;
+            }
+            if (!waitAtBarrier(header, parties))
+                return 1;
+        }
+
+        return 0;
+    }
+}
+
+bool SlabRunner::isSupported()
+{
+    return true;
+}
+
+bool SlabRunner::run(int generations, std::string& error)
+{
+    if (!Grid::readSize(mFilename, mWidth, mHeight))
+    {
+        error = "Failed to load " + mFilename;
+        return false;
+    }
+    if (mSlabCount < 1 || mSlabCount > mHeight)
+    {
+        std::ostringstream message;
+        message << "Can't split " << mHeight << " rows into " << mSlabCount << " slabs";
+        error = message.str();
+        return false;
+    }
+
+    mSlabs.clear();
+    for (int i = 0; i < mSlabCount; i++)
+    {
+        Slab slab;
+        slab.firstRow = static_cast<long long>(i)*mHeight/mSlabCount;
+        slab.rows = static_cast<long long>(i + 1)*mHeight/mSlabCount - slab.firstRow;
+        slab.heads = 0;
+        slab.tails = 0;
+        slab.peakRss = 0;
+        mSlabs.push_back(slab);
+    }
+
+    // The name is only needed until the memory is mapped. Forked workers inherit the mapping.
+    std::ostringstream name;
+    name << "/wireworld-slabs-" << getpid();
+    std::size_t size = Shared::getSize(mWidth, mSlabCount);
+    int fd = shm_open(name.str().c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        error = std::string("Failed to create shared memory: ") + std::strerror(errno);
+        return false;
+    }
+    shm_unlink(name.str().c_str());
+    void* memory = ftruncate(fd, size) == 0 ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        error = std::string("Failed to map shared memory: ") + std::strerror(errno);
+        return false;
+    }
+
+    Shared shared(memory, mWidth, mSlabCount);
+    Header& header = *new (memory) Header();
+    header.arrived.store(0);
+    header.phase.store(0);
+    header.aborted.store(0);
+
+    // Workers leave with _exit(), so anything buffered now would otherwise be lost or printed twice
+    std::cout.flush();
+
+    std::vector<pid_t> workers;
+    for (int i = 0; i < mSlabCount; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(runWorker(shared, mFilename, mEngine, i, mSlabs[i].firstRow, mSlabs[i].rows, generations));
+        if (pid < 0)
+        {
+            error = std::string("Failed to start a worker: ") + std::strerror(errno);
+            break;
+        }
+        workers.push_back(pid);
+    }
+
+    // Wait for every worker. If one fails, wake the others so they give up too.
+    bool failed = workers.size() < mSlabs.size();
+    for (std::size_t remaining = workers.size(); remaining > 0; remaining--)
+    {
+        if (failed && header.aborted.exchange(1) == 0)
+        {
+            header.phase.fetch_add(1, std::memory_order_release);
+            futex(header.phase, FUTEX_WAKE, INT_MAX);
+        }
+
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+            break;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if (error.empty())
+            {
+                std::size_t slab = 0;
+                while (slab < workers.size() && workers[slab] != pid)
+                    slab++;
+                std::ostringstream message;
+                message << "The worker for slab " << slab << " failed";
+                error = message.str();
+            }
+            failed = true;
+        }
+    }
+
+    if (!failed)
+    {
+        for (int i = 0; i < mSlabCount; i++)
+        {
+            mSlabs[i].heads = shared.result(i).heads;
+            mSlabs[i].tails = shared.result(i).tails;
+            mSlabs[i].peakRss = shared.result(i).peakRss;
+        }
+        mSeconds = header.seconds;
+        mChecksum = header.checksum;
+    }
+
+    header.~Header();
+    munmap(memory, size);
+    return !failed;
+}
+
+#else
+
+bool SlabRunner::isSupported()
+{
+    return false;
+}
+
+bool SlabRunner::run(int, std::string& error)
+{
+    error = "Slabs need Linux";
+    return false;
+}
+
+#endif
+
+SlabRunner::SlabRunner(const std::string& filename, int slabs) : mFilename(filename), mSlabCount(slabs),
+    mEngine(Grid::REFERENCE), mWidth(0), mHeight(0), mSeconds(0.0), mChecksum(0)
+{
+}
+
+void SlabRunner::printResults(std::ostream& out) const
+{
+    for (std::size_t i = 0; i < mSlabs.size(); i++)
+    {
+        const Slab& slab = mSlabs[i];
+        out << "slab " << std::setw(3) << i << "  rows " << std::setw(6) << slab.firstRow << " to "
+            << std::setw(6) << slab.firstRow + slab.rows - 1 << "  heads " << std::setw(6) << slab.heads
+            << " tails " << std::setw(6) << slab.tails << "  peak RSS " << std::setw(6)
+            << slab.peakRss/1024 << " KB\n";
+    }
+    out << mWidth << "x" << mHeight << " board in " << mSlabs.size() << " processes, checksum " << std::hex
+        << std::setw(16) << std::setfill('0') << mChecksum << std::setfill(' ') << std::dec << "\n";
+}
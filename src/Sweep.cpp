@@ -0,0 +1,292 @@
+#include "Sweep.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include "Trace.hpp"
+
+namespace
+{
+    // Next state of a cell indexed by its state and its number of head neighbours
+    const unsigned char Transition[4][9] = {
+        {NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE},
+        {WIRE, HEAD, HEAD, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE},
+        {TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL, TAIL},
+        {WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE, WIRE}
+    };
+}
+
+Sweep::Sweep(const Grid& base) : mWidth(base.getWidth()), mHeight(base.getHeight()), mConductor(mWidth*mHeight, -1),
+    mEngine(SCALAR)
+{
+    for (int y = 0; y < mHeight; y++)
+    {
+        for (int x = 0; x < mWidth; x++)
+        {
+            if (base.getCell(x, y) == NONE)
+                continue;
+            mConductor[y*mWidth + x] = mCells.size();
+            mCells.push_back(y*mWidth + x);
+            mInitial.push_back(base.getCell(x, y));
+        }
+    }
+
+    // Same neighbourhood as Grid::update(), wrapping included
+    mNeighborStart.push_back(0);
+    for (int cell : mCells)
+    {
+        int x = cell % mWidth;
+        int y = cell / mWidth;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                if (dx == 0 && dy == 0)
+                    continue;
+                int neighbor = mConductor[base.wrapY(y + dy)*mWidth + base.wrapX(x + dx)];
+                if (neighbor >= 0)
+                    mNeighbors.push_back(neighbor);
+            }
+        }
+        mNeighborStart.push_back(mNeighbors.size());
+    }
+}
+
+bool Sweep::loadVariants(const std::string& filename, std::string& error)
+{
+    TraceScope trace("load variants", "io");
+
+    std::ifstream file(filename.c_str());
+    if (!file)
+    {
+        error = "Failed to load " + filename;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+    {
+        std::istringstream tokens(line);
+        Variant variant;
+        if (!(tokens >> variant.name) || variant.name.compare(0, 2, "//") == 0)
+            continue;
+
+        std::string token;
+        while (tokens >> token)
+        {
+            std::ostringstream where;
+            where << filename << ":" << lineNumber << ": ";
+
+            unsigned char state;
+            switch (token[0])
+            {
+                case '#': state = WIRE; break;
+                case '@': state = HEAD; break;
+                case '~': state = TAIL; break;
+                default:
+                    error = where.str() + "expected #, @ or ~ before the coordinates in " + token;
+                    return false;
+            }
+
+            int x = 0;
+            int y = 0;
+            char comma = 0;
+            std::istringstream coords(token.substr(1));
+            if (!(coords >> x >> comma >> y) || comma != ',' || x < 0 || y < 0 || x >= mWidth || y >= mHeight)
+            {
+                error = where.str() + "bad coordinates in " + token;
+                return false;
+            }
+
+            int conductor = mConductor[y*mWidth + x];
+            if (conductor < 0)
+            {
+                error = where.str() + token + " is not on a wire";
+                return false;
+            }
+
+            Edit edit = {conductor, state};
+            variant.edits.push_back(edit);
+        }
+
+        variant.heads = 0;
+        variant.tails = 0;
+        variant.checksum = 0;
+        mVariants.push_back(variant);
+    }
+
+    return true;
+}
+
+void Sweep::run(int generations, int threads)
+{
+    TraceScope trace("sweep", "sim");
+
+    // Work is handed out a variant at a time, or a batch of 64 for LANES
+    std::size_t tasks = mEngine == LANES ? (mVariants.size() + 63)/64 : mVariants.size();
+    threads = std::max(1, std::min<int>(threads, tasks));
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]()
+    {
+        if (mEngine == LANES)
+        {
+            std::vector<unsigned long long> planes;
+            std::vector<unsigned long long> scratch;
+            for (std::size_t i = next++; i < tasks; i = next++)
+                runLanes(64*i, generations, planes, scratch);
+        }
+        else
+        {
+            std::vector<unsigned char> cells;
+            std::vector<unsigned char> scratch;
+            for (std::size_t i = next++; i < tasks; i = next++)
+                runVariant(mVariants[i], generations, cells, scratch);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++)
+        pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+}
+
+void Sweep::printResults(std::ostream& out) const
+{
+    for (const Variant& variant : mVariants)
+    {
+        out << std::left << std::setw(20) << variant.name << std::right << " heads " << std::setw(6) << variant.heads
+            << " tails " << std::setw(6) << variant.tails << "  checksum " << std::hex << std::setw(16)
+            << std::setfill('0') << variant.checksum << std::setfill(' ') << std::dec << "\n";
+    }
+}
+
+void Sweep::runVariant(Variant& variant, int generations, std::vector<unsigned char>& cur,
+                       std::vector<unsigned char>& scratch) const
+{
+    TraceScope trace("variant", "sim");
+
+    cur = mInitial;
+    for (const Edit& edit : variant.edits)
+        cur[edit.conductor] = edit.state;
+    scratch.resize(cur.size());
+
+    const int* start = mNeighborStart.data();
+    const int* neighbors = mNeighbors.data();
+    for (int generation = 0; generation < generations; generation++)
+    {
+        for (std::size_t i = 0; i < cur.size(); i++)
+        {
+            int heads = 0;
+            if (cur[i] == WIRE)
+            {
+                for (int k = start[i]; k < start[i+1]; k++)
+                    heads += cur[neighbors[k]] == HEAD;
+            }
+            scratch[i] = Transition[cur[i]][heads];
+        }
+        cur.swap(scratch);
+    }
+
+    summarize(variant, cur);
+}
+
+void Sweep::runLanes(std::size_t first, int generations, std::vector<unsigned long long>& planes,
+                     std::vector<unsigned long long>& scratch)
+{
+    TraceScope trace("lanes", "sim");
+
+    std::size_t lanes = std::min<std::size_t>(64, mVariants.size() - first);
+    std::size_t count = mInitial.size();
+
+    // Heads of conductor i in planes[2i] and tails in planes[2i+1], bit l for variant first+l. A
+    // lane with neither bit set is plain wire.
+    planes.assign(2*count, 0);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (mInitial[i] == HEAD)
+            planes[2*i] = ~0ull;
+        else if (mInitial[i] == TAIL)
+            planes[2*i+1] = ~0ull;
+    }
+    for (std::size_t lane = 0; lane < lanes; lane++)
+    {
+        unsigned long long bit = 1ull << lane;
+        for (const Edit& edit : mVariants[first + lane].edits)
+        {
+            planes[2*edit.conductor] &= ~bit;
+            planes[2*edit.conductor+1] &= ~bit;
+            if (edit.state == HEAD)
+                planes[2*edit.conductor] |= bit;
+            else if (edit.state == TAIL)
+                planes[2*edit.conductor+1] |= bit;
+        }
+    }
+    scratch.resize(planes.size());
+
+    const int* start = mNeighborStart.data();
+    const int* neighbors = mNeighbors.data();
+    for (int generation = 0; generation < generations; generation++)
+    {
+        const unsigned long long* cur = planes.data();
+        unsigned long long* next = scratch.data();
+        for (std::size_t i = 0; i < count; i++)
+        {
+            unsigned long long heads = cur[2*i];
+            unsigned long long tails = cur[2*i+1];
+
+            // Bit-sliced count of head neighbours in every lane: ones and twos hold the count
+            // modulo 4 and many is set once it reaches 4
+            unsigned long long ones = 0;
+            unsigned long long twos = 0;
+            unsigned long long many = 0;
+            for (int k = start[i]; k < start[i+1]; k++)
+            {
+                unsigned long long neighbor = cur[2*neighbors[k]];
+                unsigned long long carry = ones & neighbor;
+                ones ^= neighbor;
+                many |= twos & carry;
+                twos ^= carry;
+            }
+
+            // Wire with one or two head neighbours becomes a head, heads become tails and tails wire
+            next[2*i] = ~(heads | tails) & (ones ^ twos) & ~many;
+            next[2*i+1] = heads;
+        }
+        planes.swap(scratch);
+    }
+
+    std::vector<unsigned char> cells(count);
+    for (std::size_t lane = 0; lane < lanes; lane++)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if ((planes[2*i] >> lane) & 1)
+                cells[i] = HEAD;
+            else if ((planes[2*i+1] >> lane) & 1)
+                cells[i] = TAIL;
+            else
+                cells[i] = WIRE;
+        }
+        summarize(mVariants[first + lane], cells);
+    }
+}
+
+void Sweep::summarize(Variant& variant, const std::vector<unsigned char>& cells)
+{
+    variant.heads = 0;
+    variant.tails = 0;
+    variant.checksum = 14695981039346656037ull; // FNV-1a
+    for (unsigned char state : cells)
+    {
+        variant.heads += state == HEAD;
+        variant.tails += state == TAIL;
+        variant.checksum ^= state;
+        variant.checksum *= 1099511628211ull;
+    }
+}
@@ -0,0 +1,138 @@
+#include "Trace.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "MemoryReport.hpp"
+
+namespace
+{
+    struct Event
+    {
+        const char* name;
+        const char* category;
+        Trace::Clock::time_point begin;
+        Trace::Clock::time_point end;
+    };
+
+    struct Buffer
+    {
+        Buffer() : thread(0), used(0), reserved(0) {}
+
+        /// \brief Publish the size of the events for reportMemory(). Called by the owning thread,
+        /// or by any thread while the owner is idle.
+        void count()
+        {
+            used.store(events.size()*sizeof(Event), std::memory_order_relaxed);
+            reserved.store(events.capacity()*sizeof(Event), std::memory_order_relaxed);
+        }
+
+        int thread;
+        std::vector<Event> events; // Only touched by the owning thread while it may be recording
+        std::atomic<std::size_t> used; // Bytes, read by other threads
+        std::atomic<std::size_t> reserved;
+    };
+
+    // Buffers stay registered for the life of the program, since threads keep pointers to them
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<Buffer> > buffers;
+    Trace::Clock::time_point origin;
+
+    Buffer& localBuffer()
+    {
+        static thread_local Buffer* buffer = 0;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffers.push_back(std::unique_ptr<Buffer>(new Buffer));
+            buffer = buffers.back().get();
+            buffer->thread = buffers.size();
+        }
+        return *buffer;
+    }
+
+    double microseconds(Trace::Clock::duration duration)
+    {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+}
+
+std::atomic<bool> Trace::mEnabled(false);
+
+void Trace::start()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (std::unique_ptr<Buffer>& buffer : buffers)
+    {
+        buffer->events.clear();
+        buffer->count();
+    }
+    origin = Clock::now();
+    mEnabled.store(true);
+}
+
+bool Trace::write(const std::string& filename)
+{
+    mEnabled.store(false);
+
+    std::ofstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"WireWorld\"}}";
+    for (std::unique_ptr<Buffer>& buffer : buffers)
+    {
+        for (const Event& event : buffer->events)
+        {
+            file << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+                 << "\", \"ph\": \"X\", \"ts\": " << microseconds(event.begin - origin)
+                 << ", \"dur\": " << microseconds(event.end - event.begin)
+                 << ", \"pid\": 1, \"tid\": " << buffer->thread << "}";
+        }
+        buffer->events.clear();
+        buffer->count();
+    }
+    file << "\n]}\n";
+
+    return static_cast<bool>(file);
+}
+
+void Trace::reportMemory(MemoryReport& report)
+{
+    // Other threads may be recording, so only their published counts are read
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::size_t used = 0;
+    std::size_t reserved = buffers.capacity()*sizeof(buffers[0]);
+    for (std::unique_ptr<Buffer>& buffer : buffers)
+    {
+        used += buffer->used.load(std::memory_order_relaxed);
+        reserved += sizeof(Buffer) + buffer->reserved.load(std::memory_order_relaxed);
+    }
+    report.add("trace buffers", used, reserved);
+}
+
+void Trace::record(const char* name, const char* category, Clock::time_point begin, Clock::time_point end)
+{
+    Event event = {name, category, begin, end};
+    Buffer& buffer = localBuffer();
+    buffer.events.push_back(event);
+    buffer.count();
+}
+
+TraceSession::TraceSession(const std::string& filename) : mFilename(filename)
+{
+    if (!mFilename.empty())
+        Trace::start();
+}
+
+TraceSession::~TraceSession()
+{
+    if (!mFilename.empty() && !Trace::write(mFilename))
+        std::cerr << "Failed to write " << mFilename << std::endl;
+}
@@ -0,0 +1,279 @@
+#include "wireworld.h"
+
+#include <cstddef>
+#include <new>
+#include <sstream>
+
+#include "Grid.hpp"
+#include "Probes.hpp"
+#include "RunUntil.hpp"
+
+// The C enums and structs mirror the C++ ones so that nothing needs translating
+static_assert(int(WW_TAIL) == int(TAIL) && int(WW_ENGINE_INCREMENTAL) == int(Grid::INCREMENTAL) &&
+              int(WW_STOP_REPEAT) == int(RunUntil::REPEAT),
+              "wireworld.h is out of step with the C++ enums");
+static_assert(sizeof(ww_probe_event) == sizeof(Probes::Event) &&
+              offsetof(ww_probe_event, generation) == offsetof(Probes::Event, generation) &&
+              offsetof(ww_probe_event, probe) == offsetof(Probes::Event, probe),
+              "ww_probe_event must have the layout of Probes::Event");
+
+struct ww_grid
+{
+    Grid grid;
+    Probes probes;
+    long long generation;
+    bool edited; // Cells set since the last flip()
+};
+
+namespace
+{
+    bool isInside(const ww_grid* grid, int x, int y)
+    {
+        return x >= 0 && y >= 0 && x < grid->grid.getWidth() && y < grid->grid.getHeight();
+    }
+
+    void commit(ww_grid* grid)
+    {
+        if (grid->edited)
+            grid->grid.flip();
+        grid->edited = false;
+    }
+}
+
+int ww_abi_version(void)
+{
+    return WW_ABI_VERSION;
+}
+
+ww_grid* ww_create(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return 0;
+
+    ww_grid* grid = new (std::nothrow) ww_grid;
+    if (!grid)
+        return 0;
+    try
+    {
+        grid->grid = Grid(width, height);
+    }
+    catch (...)
+    {
+        delete grid;
+        return 0;
+    }
+    grid->generation = 0;
+    grid->edited = false;
+    return grid;
+}
+
+ww_grid* ww_load(const char* filename)
+{
+    ww_grid* grid = new (std::nothrow) ww_grid;
+    if (!grid)
+        return 0;
+    try
+    {
+        if (!filename || !grid->grid.loadFromFile(filename))
+        {
+            delete grid;
+            return 0;
+        }
+        grid->grid.flip(); // Commit the loaded cells
+    }
+    catch (...)
+    {
+        delete grid;
+        return 0;
+    }
+    grid->generation = 0;
+    grid->edited = false;
+    return grid;
+}
+
+void ww_destroy(ww_grid* grid)
+{
+    delete grid;
+}
+
+int ww_save(const ww_grid* grid, const char* filename)
+{
+    // Pending edits aren't part of the current state, so there is no need to commit them
+    try
+    {
+        return filename && grid->grid.saveToFile(filename);
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int ww_width(const ww_grid* grid)
+{
+    return grid->grid.getWidth();
+}
+
+int ww_height(const ww_grid* grid)
+{
+    return grid->grid.getHeight();
+}
+
+int ww_set_engine(ww_grid* grid, int engine)
+{
+    try
+    {
+        if (engine < WW_ENGINE_REFERENCE || engine > WW_ENGINE_INCREMENTAL)
+            return 0;
+        grid->grid.setEngine(static_cast<Grid::Engine>(engine));
+        return 1;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+long long ww_generation(const ww_grid* grid)
+{
+    return grid->generation;
+}
+
+int ww_get_cell(const ww_grid* grid, int x, int y)
+{
+    if (!isInside(grid, x, y))
+        return WW_NONE;
+    return grid->grid.getCell(x, y);
+}
+
+int ww_set_cell(ww_grid* grid, int x, int y, int state)
+{
+    if (state < WW_NONE || state > WW_TAIL || !isInside(grid, x, y))
+        return 0;
+    try
+    {
+        grid->grid.setCell(x, y, static_cast<CellState>(state));
+        grid->edited = true;
+        return 1;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int ww_commit(ww_grid* grid)
+{
+    try
+    {
+        commit(grid);
+        return 1;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int ww_step(ww_grid* grid, long long generations)
+{
+    try
+    {
+        commit(grid);
+        RunUntil until(generations);
+        until.run(grid->grid, grid->probes, grid->generation);
+        grid->generation = until.getGeneration();
+        return 1;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int ww_advance(ww_grid* grid, long long generations, int depth)
+{
+    if (generations < 0)
+        return 0;
+
+    try
+    {
+        commit(grid);
+        grid->grid.advance(generations, depth);
+        grid->generation += generations;
+        return 1;
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int ww_run_until(ww_grid* grid, long long limit, const char* conditions)
+{
+    try
+    {
+        RunUntil until(limit);
+        std::string error;
+        std::istringstream list(conditions ? conditions : "");
+        std::string condition;
+        while (std::getline(list, condition, ','))
+        {
+            if (!until.parse(condition, error))
+                return -1;
+        }
+        if (!until.validate(grid->probes, error))
+            return -1;
+
+        commit(grid);
+        RunUntil::Reason reason = until.run(grid->grid, grid->probes, grid->generation);
+        grid->generation = until.getGeneration();
+        return reason;
+    }
+    catch (...)
+    {
+        return -2;
+    }
+}
+
+const unsigned char* ww_cells(const ww_grid* grid, size_t* stride)
+{
+    if (stride)
+        *stride = Grid::getCellStride();
+    return grid->grid.getCellData();
+}
+
+int ww_add_probe(ww_grid* grid, const char* name, int x, int y)
+{
+    if (!name || ww_get_cell(grid, x, y) == WW_NONE)
+        return -1;
+    try
+    {
+        grid->probes.add(name, x, y);
+        return static_cast<int>(grid->probes.getCount()) - 1;
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
+
+const char* ww_probe_name(const ww_grid* grid, int probe)
+{
+    if (probe < 0 || probe >= static_cast<int>(grid->probes.getCount()))
+        return 0;
+    return grid->probes.getName(probe).c_str();
+}
+
+const ww_probe_event* ww_probe_events(const ww_grid* grid, size_t* count)
+{
+    const std::vector<Probes::Event>& events = grid->probes.getEvents();
+    if (count)
+        *count = events.size();
+    return events.empty() ? 0 : reinterpret_cast<const ww_probe_event*>(&events[0]);
+}
+
+void ww_clear_probe_events(ww_grid* grid)
+{
+    grid->probes.clearEvents();
+}